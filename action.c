@@ -0,0 +1,172 @@
+/*
+    irmplircd -- zeroconf LIRC daemon that reads IRMP events from the USB IR Remote Receiver
+	             http://www.mikrocontroller.net/articles/USB_IR_Remote_Receiver
+    Copyright (C) 2011-2014  Dirk E. Wagner
+
+    This program is free software; you can redistribute it and/or modify it
+    under the terms of version 2 of the GNU General Public License as published
+    by the Free Software Foundation.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program; if not, write to the Free Software
+    Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301 USA
+*/
+
+ /* Standard headers */
+#include <stdio.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <signal.h>
+#include <spawn.h>
+#include <sys/wait.h>
+
+#include "debug.h"
+#include "hashmap.h"
+#include "mapping.h"
+#include "sequence.h"
+#include "log.h"
+#include "action.h"
+
+extern char **environ;
+
+static sequence_table_t *sequences = NULL;
+static pid_t *running = NULL;	// commands not reaped yet, other children are not ours to wait for
+static int nrunning = 0;
+static int running_size = 0;
+
+static int resolve_entry(any_t table, any_t data) {
+	sequence_table_t *sequences = table;
+	map_entry_t *map_entry = data;
+	char key[KEY_MAX_LENGTH + 3];
+	size_t len = strcspn(map_entry->value, " \t\r\n");
+
+	snprintf(key, sizeof key, "%.*s", (int) len, map_entry->value);
+	map_entry->token = sequence_token(sequences, key);
+
+	snprintf(key, sizeof key, "%.*s_UP", (int) len, map_entry->value);
+	map_entry->release_token = sequence_token(sequences, key);
+
+	return MAP_OK;
+}
+
+bool action_open(const char *path, map_t mymap) {
+	sequence_table_t *table = sequence_table_new();
+
+	/* On a reload the current table stays if the new one is broken */
+	if (!table || !parse_sequence_table(path, table)) {
+		sequence_table_free(table);
+		return false;
+	}
+
+	if (hashmap_length(mymap) > 0)
+		hashmap_iterate(mymap, resolve_entry, table);
+
+	sequence_table_free(sequences);
+	sequences = table;
+
+	DBG ("action_open: %d actions\n", sequence_count(sequences));
+	return true;
+}
+
+bool action_active(void) {
+	return sequences != NULL;
+}
+
+static void spawn(const char *action) {
+	char *argv[] = { "sh", "-c", (char *) action, NULL };
+	posix_spawnattr_t attr;
+	sigset_t mask;
+	pid_t pid, *pids;
+	int err;
+
+	/* Commands get the signal handling of a freshly started shell */
+	posix_spawnattr_init(&attr);
+	sigemptyset(&mask);
+	posix_spawnattr_setsigmask(&attr, &mask);
+	sigaddset(&mask, SIGPIPE);
+	sigaddset(&mask, SIGCHLD);
+	posix_spawnattr_setsigdefault(&attr, &mask);
+	posix_spawnattr_setflags(&attr, POSIX_SPAWN_SETSIGMASK | POSIX_SPAWN_SETSIGDEF);
+
+	err = posix_spawn(&pid, "/bin/sh", NULL, &attr, argv, environ);
+	posix_spawnattr_destroy(&attr);
+
+	if (err) {
+		LOG(LOG_ERR, "Unable to execute %s: %s", action, strerror(err));
+		return;
+	}
+
+	LOG(LOG_INFO, "executing by IRMP (%s), pid %d", action, pid);
+
+	if (nrunning == running_size) {
+		pids = realloc(running, (running_size ? 2 * running_size : 8) * sizeof *pids);
+		if (!pids) {
+			LOG(LOG_ERR, "Unable to track command %d, it stays a zombie", pid);
+			return;
+		}
+		running = pids;
+		running_size = running_size ? 2 * running_size : 8;
+	}
+	running[nrunning++] = pid;
+}
+
+void action_feed(const map_entry_t *map_entry, int repeat, bool release, uint64_t now_ms) {
+	const char *action;
+
+	if (!sequences)
+		return;
+
+	action = sequence_feed_token(sequences, release ? map_entry->release_token : map_entry->token, repeat, release, now_ms);
+	if (action)
+		spawn(action);
+	action_timeout(now_ms);
+}
+
+void action_feed_name(const char *key, int repeat, uint64_t now_ms) {
+	const char *action;
+
+	if (!sequences)
+		return;
+
+	action = sequence_feed(sequences, key, repeat, now_ms);
+	if (action)
+		spawn(action);
+	action_timeout(now_ms);
+}
+
+int action_timeout(uint64_t now_ms) {
+	const char *action;
+
+	if (!sequences)
+		return -1;
+
+	while ((action = sequence_expire(sequences, now_ms)))
+		spawn(action);
+
+	return sequence_wait(sequences, now_ms);
+}
+
+void action_reap(void) {
+	int status, i;
+	pid_t pid;
+
+	/* Never waitpid(-1), that would also collect the upgrade binary */
+	for (i = 0; i < nrunning; ) {
+		if ((pid = waitpid(running[i], &status, WNOHANG)) == 0) {
+			i++;
+			continue;
+		}
+
+		if (pid > 0 && WIFEXITED(status) && WEXITSTATUS(status))
+			LOG(LOG_INFO, "command %d exited with status %d", running[i], WEXITSTATUS(status));
+		running[i] = running[--nrunning];
+	}
+}
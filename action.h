@@ -0,0 +1,41 @@
+/*
+    irmplircd -- zeroconf LIRC daemon that reads IRMP events from the USB IR Remote Receiver
+	             http://www.mikrocontroller.net/articles/USB_IR_Remote_Receiver
+    Copyright (C) 2011-2014  Dirk E. Wagner
+
+    This program is free software; you can redistribute it and/or modify it
+    under the terms of version 2 of the GNU General Public License as published
+    by the Free Software Foundation.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program; if not, write to the Free Software
+    Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301 USA
+*/
+
+#ifndef __ACTION_H__
+#define __ACTION_H__
+
+/*
+ * Runs the commands of an irmpexec.map style action table from within
+ * irmplircd. Key names of the translation table are resolved to sequence
+ * tokens once at load, commands are spawned without waiting for them.
+ */
+bool action_open(const char *path, map_t mymap);	// also reloads
+bool action_active(void);
+
+/* Feed a mapped key, or the key name of an unmapped one */
+void action_feed(const map_entry_t *map_entry, int repeat, bool release, uint64_t now_ms);
+void action_feed_name(const char *key, int repeat, uint64_t now_ms);
+
+/* Run sequences held back for a longer one once due, returns ms until the next is */
+int action_timeout(uint64_t now_ms);
+
+/* Collect exited commands, called from the main loop */
+void action_reap(void);
+
+#endif
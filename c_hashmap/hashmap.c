@@ -1,48 +1,189 @@
 /*
  * Generic map implementation.
+ *
+ * Entries are kept densely in insertion order. The hash table itself is
+ * only an index of 8, 16 or 32 bit entry numbers, sized to the number of
+ * entries it has to address, so a probe touches a few bytes and iteration
+ * is a linear walk over packed entries.
+ *
+ * Maps created with hashmap_new_concurrent() may be read by any number of
+ * threads while one thread writes. Readers never block or retry: index
+ * slots and entry fields are published with release stores, a resize
+ * publishes a new table and the old one is freed once every reader that
+ * may still use it has left (two reader counters, flipped by an epoch).
+ * A removed entry or a NULL value reads as missing.
  */
 #include "hashmap.h"
 
 #include <stdlib.h>
 #include <stdio.h>
+#include <stdint.h>
 #include <string.h>
+#include <limits.h>
+#include <sched.h>
 
 #define INITIAL_SIZE (256)
-#define MAX_CHAIN_LENGTH (8)
+
+#define LOAD(x) __atomic_load_n(&(x), __ATOMIC_ACQUIRE)
+#define STORE(x, v) __atomic_store_n(&(x), (v), __ATOMIC_RELEASE)
+
+/* Index slot value of a slot that was never used */
+#define SLOT_EMPTY (0)
+
+/* Entry key lengths with a special meaning */
+#define KEY_INT (UINT_MAX - 1)		/* uint64_t key stored in the entry */
+#define KEY_REMOVED (UINT_MAX)
 
 /* We need to keep keys and values */
-typedef struct _hashmap_element{
-	char* key;
-	int in_use;
+typedef struct _hashmap_entry{
+	union {
+		const void* ptr;
+		uint64_t u64;
+	} key;
+	unsigned int hash;	/* full hash, compared before the key */
+	unsigned int len;	/* key bytes, KEY_INT or KEY_REMOVED */
 	any_t data;
-} hashmap_element;
-
-/* A hashmap has some maximum size and current size,
- * as well as the data to hold. */
+} hashmap_entry;
+
+/* What a lookup is looking for */
+typedef struct _hashmap_key{
+	const void* ptr;
+	uint64_t u64;
+	unsigned int len;
+	unsigned int hash;
+} hashmap_key;
+
+/* Index and entries share one allocation, swapped as a whole on resize */
+typedef struct _hashmap_table{
+	unsigned int mask;	/* index slots - 1, slots are a power of two */
+	int width;		/* bytes per index slot */
+	int capacity;		/* entries that fit, at most half the slots */
+	int used;		/* entries appended, including removed ones */
+	hashmap_entry *entries;
+	unsigned char index[];	/* slot value is entry number + 1 */
+} hashmap_table;
+
+/* A hashmap has a current size and a table to hold the data. */
 typedef struct _hashmap_map{
-	int table_size;
 	int size;
-	hashmap_element *data;
+	hashmap_table *table;
+	int concurrent;
+	unsigned long epoch;	/* parity selects the counter new readers use */
+	long readers[2];
 } hashmap_map;
 
+static hashmap_table *hashmap_table_new(unsigned int slots) {
+	int capacity = slots / 2;
+	int width = capacity < UINT8_MAX ? 1 : capacity < UINT16_MAX ? 2 : 4;
+	size_t index_size = (slots * width + sizeof(void *) - 1) & ~(sizeof(void *) - 1);
+	hashmap_table *t;
+
+	t = (hashmap_table *) calloc(1, sizeof(hashmap_table) + index_size + capacity * sizeof(hashmap_entry));
+	if(!t) return NULL;
+
+	t->mask = slots - 1;
+	t->width = width;
+	t->capacity = capacity;
+	t->used = 0;
+	t->entries = (hashmap_entry *) (t->index + index_size);
+
+	return t;
+}
+
+static inline unsigned int slot_get(const hashmap_table *t, unsigned int slot) {
+	switch(t->width) {
+		case 1: return LOAD(t->index[slot]);
+		case 2: return LOAD(((const uint16_t *) t->index)[slot]);
+		default: return LOAD(((const uint32_t *) t->index)[slot]);
+	}
+}
+
+static inline void slot_set(hashmap_table *t, unsigned int slot, unsigned int value) {
+	switch(t->width) {
+		case 1: STORE(t->index[slot], value); break;
+		case 2: STORE(((uint16_t *) t->index)[slot], value); break;
+		default: STORE(((uint32_t *) t->index)[slot], value); break;
+	}
+}
+
 /*
- * Return an empty hashmap, or NULL on failure.
+ * Readers announce themselves before they load the table. Returns the
+ * counter to leave through.
  */
-map_t hashmap_new() {
-	hashmap_map* m = (hashmap_map*) malloc(sizeof(hashmap_map));
-	if(!m) goto err;
+static inline int read_lock(hashmap_map *m) {
+	int e;
+
+	if(!m->concurrent) return 0;
+
+	e = __atomic_load_n(&m->epoch, __ATOMIC_SEQ_CST) & 1;
+	__atomic_fetch_add(&m->readers[e], 1, __ATOMIC_SEQ_CST);
+	return e;
+}
+
+static inline void read_unlock(hashmap_map *m, int e) {
+	if(m->concurrent)
+		__atomic_fetch_sub(&m->readers[e], 1, __ATOMIC_RELEASE);
+}
+
+static inline hashmap_table *table_get(hashmap_map *m) {
+	return __atomic_load_n(&m->table, __ATOMIC_SEQ_CST);
+}
 
-	m->data = (hashmap_element*) calloc(INITIAL_SIZE, sizeof(hashmap_element));
-	if(!m->data) goto err;
+static hashmap_map *hashmap_alloc(int concurrent) {
+	hashmap_map* m = (hashmap_map*) calloc(1, sizeof(hashmap_map));
+	if(!m) return NULL;
+
+	m->table = hashmap_table_new(INITIAL_SIZE);
+	if(!m->table) {
+		free(m);
+		return NULL;
+	}
 
-	m->table_size = INITIAL_SIZE;
 	m->size = 0;
+	m->concurrent = concurrent;
 
 	return m;
-	err:
-		if (m)
-			hashmap_free(m);
-		return NULL;
+}
+
+/*
+ * Return an empty hashmap, or NULL on failure.
+ */
+map_t hashmap_new() {
+	return hashmap_alloc(0);
+}
+
+map_t hashmap_new_concurrent() {
+	return hashmap_alloc(1);
+}
+
+/* Send new readers to the other counter and wait for the old one to drain */
+static void flip_and_wait(hashmap_map *m) {
+	unsigned long e = __atomic_fetch_add(&m->epoch, 1, __ATOMIC_SEQ_CST);
+
+	while(__atomic_load_n(&m->readers[e & 1], __ATOMIC_SEQ_CST) != 0)
+		sched_yield();
+}
+
+/*
+ * Wait until all readers that were running when called have finished.
+ * A reader may have loaded the old parity and count itself in only after
+ * the first wait, so wait for the other counter as well, like SRCU does.
+ */
+void hashmap_synchronize(map_t in) {
+	hashmap_map* m = (hashmap_map *) in;
+
+	if(!m->concurrent) return;
+
+	flip_and_wait(m);
+	flip_and_wait(m);
+}
+
+int hashmap_read_lock(map_t in) {
+	return read_lock((hashmap_map *) in);
+}
+
+void hashmap_read_unlock(map_t in, int section) {
+	read_unlock((hashmap_map *) in, section);
 }
 
 /* The implementation here was originally done by Gary S. Brown.  I have
@@ -146,9 +287,9 @@ static unsigned long crc32_tab[] = {
 
 /* Return a 32-bit CRC of the contents of the buffer. */
 
-unsigned long crc32(const unsigned char *s, unsigned int len)
+unsigned long crc32(const unsigned char *s, size_t len)
 {
-  unsigned int i;
+  size_t i;
   unsigned long crc32val;
   
   crc32val = 0;
@@ -162,11 +303,11 @@ unsigned long crc32(const unsigned char *s, unsigned int len)
 }
 
 /*
- * Hashing function for a string
+ * Hashing function for a byte string
  */
-unsigned int hashmap_hash_int(hashmap_map * m, char* keystring){
+static unsigned int hashmap_hash_bin(const void* data, size_t len){
 
-    unsigned long key = crc32((unsigned char*)(keystring), strlen(keystring));
+    unsigned long key = crc32((const unsigned char*)(data), len);
 
 	/* Robert Jenkins' 32 bit Mix Function */
 	key += (key << 12);
@@ -181,217 +322,306 @@ unsigned int hashmap_hash_int(hashmap_map * m, char* keystring){
 	/* Knuth's Multiplicative Method */
 	key = (key >> 3) * 2654435761;
 
-	return key % m->table_size;
+	return key;
 }
 
 /*
- * Return the integer of the location in data
- * to store the point to the item, or MAP_FULL.
+ * Hashing function for an integer, the 64 bit finalizer of MurmurHash3
  */
-int hashmap_hash(map_t in, char* key){
-	int curr;
-	int i;
+static unsigned int hashmap_hash_u64(uint64_t key){
+	key ^= key >> 33;
+	key *= 0xff51afd7ed558ccdULL;
+	key ^= key >> 33;
+	key *= 0xc4ceb9fe1a85ec53ULL;
+	key ^= key >> 33;
+
+	return key;
+}
 
-	/* Cast the hashmap */
-	hashmap_map* m = (hashmap_map *) in;
+static hashmap_key key_bin(const void* key, size_t len){
+	hashmap_key k = { key, 0, len, hashmap_hash_bin(key, len) };
+	return k;
+}
+
+static hashmap_key key_u64(uint64_t key){
+	hashmap_key k = { NULL, key, KEY_INT, hashmap_hash_u64(key) };
+	return k;
+}
 
-	/* If full, return immediately */
-	if(m->size >= (m->table_size/2)) return MAP_FULL;
+static inline int key_equal(const hashmap_entry *e, const hashmap_key *k){
+	unsigned int len;
 
-	/* Find the best index */
-	curr = hashmap_hash_int(m, key);
+	if(e->hash != k->hash)
+		return 0;
 
-	/* Linear probing */
-	for(i = 0; i< MAX_CHAIN_LENGTH; i++){
-		if(m->data[curr].in_use == 0)
-			return curr;
+	len = LOAD(e->len);
+	if(len != k->len)
+		return 0;
+
+	if(len == KEY_INT)
+		return e->key.u64 == k->u64;
+
+	return memcmp(LOAD(e->key.ptr), k->ptr, len) == 0;
+}
+
+/*
+ * Return the index slot holding key, or the empty slot ending its probe
+ * sequence, and in ix the slot value seen, SLOT_EMPTY if not found.
+ * Removed entries stay in the index until the next resize.
+ */
+static unsigned int hashmap_lookup(const hashmap_table *t, const hashmap_key *k, unsigned int *ix){
+	unsigned int curr = k->hash & t->mask;
 
-		if(m->data[curr].in_use == 1 && (strcmp(m->data[curr].key,key)==0))
+	/* Linear probing, the index is at most half full */
+	while((*ix = slot_get(t, curr)) != SLOT_EMPTY){
+		if(key_equal(&t->entries[*ix - 1], k))
 			return curr;
 
-		curr = (curr + 1) % m->table_size;
+		curr = (curr + 1) & t->mask;
 	}
 
-	return MAP_FULL;
+	return curr;
 }
 
 /*
- * Doubles the size of the hashmap, and rehashes all the elements
+ * Moves the live entries into a new table, doubling it unless removals
+ * freed enough room, which also drops removed entries from the index.
  */
-int hashmap_rehash(map_t in){
+static int hashmap_rehash(hashmap_map *m){
+	hashmap_table *old = m->table;
+	unsigned int slots = old->mask + 1;
+	hashmap_table *t;
+	unsigned int ix;
 	int i;
-	int old_size;
-	hashmap_element* curr;
-
-	/* Setup the new elements */
-	hashmap_map *m = (hashmap_map *) in;
-	hashmap_element* temp = (hashmap_element *)
-		calloc(2 * m->table_size, sizeof(hashmap_element));
-	if(!temp) return MAP_OMEM;
-
-	/* Update the array */
-	curr = m->data;
-	m->data = temp;
-
-	/* Update the size */
-	old_size = m->table_size;
-	m->table_size = 2 * m->table_size;
-	m->size = 0;
 
-	/* Rehash the elements */
-	for(i = 0; i < old_size; i++){
-        int status;
+	if(m->size >= old->capacity / 2)
+		slots *= 2;
+
+	t = hashmap_table_new(slots);
+	if(!t) return MAP_OMEM;
+
+	for(i = 0; i < old->used; i++){
+		hashmap_entry *e = &old->entries[i];
+		hashmap_key k = { e->key.ptr, e->key.u64, e->len, e->hash };
+
+		if(e->len == KEY_REMOVED)
+			continue;
 
-        if (curr[i].in_use == 0)
-            continue;
-            
-		status = hashmap_put(m, curr[i].key, curr[i].data);
-		if (status != MAP_OK)
-			return status;
+		t->entries[t->used] = *e;
+		slot_set(t, hashmap_lookup(t, &k, &ix), ++t->used);
 	}
 
-	free(curr);
+	__atomic_store_n(&m->table, t, __ATOMIC_SEQ_CST);
+	hashmap_synchronize(m);
+	free(old);
 
 	return MAP_OK;
 }
 
-/*
- * Add a pointer to the hashmap with some key
- */
-int hashmap_put(map_t in, char* key, any_t value){
-	int index;
-	hashmap_map* m;
-
-	/* Cast the hashmap */
-	m = (hashmap_map *) in;
+static int hashmap_put_key(hashmap_map* m, const hashmap_key *k, any_t value){
+	unsigned int curr;
+	unsigned int ix;
+	hashmap_table *t;
+
+	curr = hashmap_lookup(m->table, k, &ix);
+	if(ix != SLOT_EMPTY){
+		/* The new key takes over, so the caller may free the old one */
+		if(k->len != KEY_INT)
+			STORE(m->table->entries[ix - 1].key.ptr, k->ptr);
+		STORE(m->table->entries[ix - 1].data, value);
+		return MAP_OK;
+	}
 
-	/* Find a place to put our value */
-	index = hashmap_hash(in, key);
-	while(index == MAP_FULL){
-		if (hashmap_rehash(in) == MAP_OMEM) {
+	if(m->table->used == m->table->capacity){
+		if(hashmap_rehash(m) == MAP_OMEM)
 			return MAP_OMEM;
-		}
-		index = hashmap_hash(in, key);
+		curr = hashmap_lookup(m->table, k, &ix);
+	}
+
+	/* Fill the entry before the index slot makes it visible */
+	t = m->table;
+	if(k->len == KEY_INT)
+		t->entries[t->used].key.u64 = k->u64;
+	else
+		t->entries[t->used].key.ptr = k->ptr;
+	t->entries[t->used].hash = k->hash;
+	t->entries[t->used].len = k->len;
+	t->entries[t->used].data = value;
+	STORE(t->used, t->used + 1);
+	slot_set(t, curr, t->used);
+	STORE(m->size, m->size + 1);
+
+	return MAP_OK;
+}
+
+static int hashmap_get_key(hashmap_map* m, const hashmap_key *k, any_t *arg){
+	int e = read_lock(m);
+	hashmap_table *t = table_get(m);
+	int status = MAP_MISSING;
+	unsigned int ix;
+
+	hashmap_lookup(t, k, &ix);
+
+	*arg = NULL;
+	if(ix != SLOT_EMPTY){
+		*arg = LOAD(t->entries[ix - 1].data);
+		/* Removed meanwhile, the writer blanks len before data */
+		if(*arg && key_equal(&t->entries[ix - 1], k))
+			status = MAP_OK;
+		else
+			*arg = NULL;
 	}
 
-	/* Set the data */
-	m->data[index].data = value;
-	m->data[index].key = key;
-	m->data[index].in_use = 1;
-	m->size++; 
+	read_unlock(m, e);
+	return status;
+}
+
+static int hashmap_remove_key(hashmap_map* m, const hashmap_key *k){
+	hashmap_table *t = m->table;
+	unsigned int ix;
+
+	hashmap_lookup(t, k, &ix);
+
+	/* Data not found */
+	if(ix == SLOT_EMPTY)
+		return MAP_MISSING;
+
+	/* Blank out the entry, the index keeps pointing at it for probing */
+	STORE(t->entries[ix - 1].len, KEY_REMOVED);
+	STORE(t->entries[ix - 1].data, NULL);
 
+	/* Reduce the size */
+	STORE(m->size, m->size - 1);
 	return MAP_OK;
 }
 
 /*
- * Get your pointer out of the hashmap with a key
+ * Add a pointer to the hashmap with some key, replacing an existing one
  */
-int hashmap_get(map_t in, char* key, any_t *arg){
-	int curr;
-	int i;
-	hashmap_map* m;
-
-	/* Cast the hashmap */
-	m = (hashmap_map *) in;
+int hashmap_put(map_t in, char* key, any_t value){
+	hashmap_key k = key_bin(key, strlen(key));
+	return hashmap_put_key((hashmap_map *) in, &k, value);
+}
 
-	/* Find data location */
-	curr = hashmap_hash_int(m, key);
+int hashmap_put_bin(map_t in, const void* key, size_t len, any_t value){
+	hashmap_key k = key_bin(key, len);
 
-	/* Linear probing, if necessary */
-	for(i = 0; i<MAX_CHAIN_LENGTH; i++){
+	if(len >= KEY_INT)
+		return MAP_FULL;
+	return hashmap_put_key((hashmap_map *) in, &k, value);
+}
 
-        int in_use = m->data[curr].in_use;
-        if (in_use == 1){
-            if (strcmp(m->data[curr].key,key)==0){
-                *arg = (m->data[curr].data);
-                return MAP_OK;
-            }
-		}
+int hashmap_put_u64(map_t in, uint64_t key, any_t value){
+	hashmap_key k = key_u64(key);
+	return hashmap_put_key((hashmap_map *) in, &k, value);
+}
 
-		curr = (curr + 1) % m->table_size;
-	}
+/*
+ * Get your pointer out of the hashmap with a key
+ */
+int hashmap_get(map_t in, char* key, any_t *arg){
+	hashmap_key k = key_bin(key, strlen(key));
+	return hashmap_get_key((hashmap_map *) in, &k, arg);
+}
 
-	*arg = NULL;
+int hashmap_get_bin(map_t in, const void* key, size_t len, any_t *arg){
+	hashmap_key k = key_bin(key, len);
+	return hashmap_get_key((hashmap_map *) in, &k, arg);
+}
 
-	/* Not found */
-	return MAP_MISSING;
+int hashmap_get_u64(map_t in, uint64_t key, any_t *arg){
+	hashmap_key k = key_u64(key);
+	return hashmap_get_key((hashmap_map *) in, &k, arg);
 }
 
 /*
- * Iterate the function parameter over each element in the hashmap.  The
- * additional any_t argument is passed to the function as its first
- * argument and the hashmap element is the second.
+ * Iterate the function parameter over each element in the hashmap, in
+ * insertion order.  The additional any_t argument is passed to the
+ * function as its first argument and the hashmap element is the second.
  */
 int hashmap_iterate(map_t in, PFany f, any_t item) {
-	int i;
+	int i, used;
+	int status = MAP_OK;
 
 	/* Cast the hashmap */
 	hashmap_map* m = (hashmap_map*) in;
+	int e = read_lock(m);
+	hashmap_table *t = table_get(m);
 
 	/* On empty hashmap, return immediately */
-	if (hashmap_length(m) <= 0)
+	if (hashmap_length(m) <= 0) {
+		read_unlock(m, e);
 		return MAP_MISSING;	
+	}
 
-	/* Linear probing */
-	for(i = 0; i< m->table_size; i++)
-		if(m->data[i].in_use != 0) {
-			any_t data = (any_t) (m->data[i].data);
-			int status = f(item, data);
-			if (status != MAP_OK) {
-				return status;
-			}
-		}
+	used = LOAD(t->used);
+	for(i = 0; i < used && status == MAP_OK; i++) {
+		any_t data = LOAD(t->entries[i].data);
 
-    return MAP_OK;
+		if(data && LOAD(t->entries[i].len) != KEY_REMOVED)
+			status = f(item, data);
+	}
+
+	read_unlock(m, e);
+	return status;
 }
 
 /*
  * Remove an element with that key from the map
  */
 int hashmap_remove(map_t in, char* key){
-	int i;
-	int curr;
-	hashmap_map* m;
+	hashmap_key k = key_bin(key, strlen(key));
+	return hashmap_remove_key((hashmap_map *) in, &k);
+}
 
-	/* Cast the hashmap */
-	m = (hashmap_map *) in;
-
-	/* Find key */
-	curr = hashmap_hash_int(m, key);
-
-	/* Linear probing, if necessary */
-	for(i = 0; i<MAX_CHAIN_LENGTH; i++){
-
-        int in_use = m->data[curr].in_use;
-        if (in_use == 1){
-            if (strcmp(m->data[curr].key,key)==0){
-                /* Blank out the fields */
-                m->data[curr].in_use = 0;
-                m->data[curr].data = NULL;
-                m->data[curr].key = NULL;
-
-                /* Reduce the size */
-                m->size--;
-                return MAP_OK;
-            }
+int hashmap_remove_bin(map_t in, const void* key, size_t len){
+	hashmap_key k = key_bin(key, len);
+	return hashmap_remove_key((hashmap_map *) in, &k);
+}
+
+int hashmap_remove_u64(map_t in, uint64_t key){
+	hashmap_key k = key_u64(key);
+	return hashmap_remove_key((hashmap_map *) in, &k);
+}
+
+/*
+ * Get the oldest element, optionally removing it from the map
+ */
+int hashmap_get_one(map_t in, any_t *arg, int remove){
+	hashmap_map* m = (hashmap_map *) in;
+	int e = read_lock(m);
+	hashmap_table *t = table_get(m);
+	int i, used = LOAD(t->used);
+
+	for(i = 0; i < used; i++) {
+		hashmap_entry *entry = &t->entries[i];
+		hashmap_key k = { entry->key.ptr, entry->key.u64, LOAD(entry->len), entry->hash };
+
+		if(k.len != KEY_REMOVED) {
+			*arg = LOAD(entry->data);
+			read_unlock(m, e);
+			if(remove)
+				hashmap_remove_key(m, &k);
+			return MAP_OK;
 		}
-		curr = (curr + 1) % m->table_size;
 	}
 
-	/* Data not found */
+	read_unlock(m, e);
+	*arg = NULL;
 	return MAP_MISSING;
 }
 
 /* Deallocate the hashmap */
 void hashmap_free(map_t in){
 	hashmap_map* m = (hashmap_map*) in;
-	free(m->data);
+	if(!m) return;
+	free(m->table);
 	free(m);
 }
 
 /* Return the length of the hashmap */
 int hashmap_length(map_t in){
 	hashmap_map* m = (hashmap_map *) in;
-	if(m != NULL) return m->size;
+	if(m != NULL) return LOAD(m->size);
 	else return 0;
-}
\ No newline at end of file
+}
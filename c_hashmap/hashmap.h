@@ -5,10 +5,16 @@
  *
  * Modified by Pete Warden to fix a serious performance problem, support strings as keys
  * and removed thread synchronization - http://petewarden.typepad.com
+ *
+ * Concurrent readers are supported again for maps created with
+ * hashmap_new_concurrent(), without locks on the read side.
  */
 #ifndef __HASHMAP_H__
 #define __HASHMAP_H__
 
+#include <stddef.h>
+#include <stdint.h>
+
 #define MAP_MISSING -3  /* No such element */
 #define MAP_FULL -2 	/* Hashmap is full */
 #define MAP_OMEM -1 	/* Out of Memory */
@@ -38,6 +44,28 @@ typedef any_t map_t;
 */
 extern map_t hashmap_new();
 
+/*
+ * Return an empty hashmap whose get, iterate, get_one (without remove)
+ * and length calls may run in any number of threads in parallel with
+ * one thread that puts and removes. Readers never block.
+ */
+extern map_t hashmap_new_concurrent();
+
+/*
+ * Wait until readers running at the time of the call have finished.
+ * A writer calls this after hashmap_remove() before it frees the removed
+ * key or value.
+ */
+extern void hashmap_synchronize(map_t in);
+
+/*
+ * Enter and leave a read section of a concurrent map. Values found
+ * inside the section stay valid until it is left, hashmap_synchronize()
+ * waits for it. Sections may nest.
+ */
+extern int hashmap_read_lock(map_t in);
+extern void hashmap_read_unlock(map_t in, int section);
+
 /*
  * Iteratively call f with argument (item, data) for
  * each element data in the hashmap. The function must
@@ -48,7 +76,8 @@ extern map_t hashmap_new();
 extern int hashmap_iterate(map_t in, PFany f, any_t item);
 
 /*
- * Add an element to the hashmap. Return MAP_OK or MAP_OMEM.
+ * Add an element to the hashmap. Return MAP_OK or MAP_OMEM. An element
+ * with an equal key is replaced, key and value.
  */
 extern int hashmap_put(map_t in, char* key, any_t value);
 
@@ -62,6 +91,23 @@ extern int hashmap_get(map_t in, char* key, any_t *arg);
  */
 extern int hashmap_remove(map_t in, char* key);
 
+/*
+ * The same for keys of len bytes. A string key equals the binary key of
+ * its characters without the terminating NUL. Keys are not copied, they
+ * have to stay valid while they are in the map.
+ */
+extern int hashmap_put_bin(map_t in, const void* key, size_t len, any_t value);
+extern int hashmap_get_bin(map_t in, const void* key, size_t len, any_t *arg);
+extern int hashmap_remove_bin(map_t in, const void* key, size_t len);
+
+/*
+ * The same for integer keys, which are stored in the map itself and
+ * never equal a string or binary key.
+ */
+extern int hashmap_put_u64(map_t in, uint64_t key, any_t value);
+extern int hashmap_get_u64(map_t in, uint64_t key, any_t *arg);
+extern int hashmap_remove_u64(map_t in, uint64_t key);
+
 /*
  * Get any element. Return MAP_OK or MAP_MISSING.
  * remove - should the element be removed from the hashmap
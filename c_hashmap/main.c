@@ -5,12 +5,15 @@
 #include <stdlib.h>
 #include <stdio.h>
 #include <assert.h>
+#include <pthread.h>
 
 #include "hashmap.h"
 
 #define KEY_MAX_LENGTH (256)
 #define KEY_PREFIX ("somekey")
 #define KEY_COUNT (1024*1024)
+#define RACE_KEYS (4096)
+#define RACE_ROUNDS (200)
 
 typedef struct data_struct_s
 {
@@ -18,6 +21,79 @@ typedef struct data_struct_s
     int number;
 } data_struct_t;
 
+static int check_order(any_t item, any_t data)
+{
+    int* expected = (int*) item;
+    data_struct_t* value = (data_struct_t*) data;
+
+    if (value->number != (*expected)++)
+        return MAP_MISSING;
+    return MAP_OK;
+}
+
+static map_t racemap;
+static data_struct_t race_values[RACE_KEYS];
+static int race_done = 0;
+
+/* Looks keys up while the main thread removes them and resizes the map */
+static void* race_reader(void* arg)
+{
+    unsigned long* found = (unsigned long*) arg;
+    data_struct_t* value;
+    uint64_t key;
+
+    while (!__atomic_load_n(&race_done, __ATOMIC_ACQUIRE))
+    {
+        for (key=0; key<RACE_KEYS; key+=1)
+        {
+            if (hashmap_get_u64(racemap, key, (void**)(&value)) == MAP_OK)
+            {
+                assert(value != NULL);
+                assert(value->number == key);
+                (*found)++;
+            }
+        }
+    }
+
+    return NULL;
+}
+
+/* One writer, concurrent readers, as the fanout workers use the command replies */
+static void race_test(void)
+{
+    pthread_t reader;
+    unsigned long found = 0;
+    int round, index, error;
+
+    racemap = hashmap_new_concurrent();
+    for (index=0; index<RACE_KEYS; index+=1)
+        race_values[index].number = index;
+
+    error = pthread_create(&reader, NULL, race_reader, &found);
+    assert(error==0);
+
+    /* Removed entries fill the table up, so every round resizes it */
+    for (round=0; round<RACE_ROUNDS; round+=1)
+    {
+        for (index=0; index<RACE_KEYS; index+=1)
+        {
+            error = hashmap_put_u64(racemap, index, &race_values[index]);
+            assert(error==MAP_OK);
+        }
+        for (index=0; index<RACE_KEYS; index+=1)
+        {
+            error = hashmap_remove_u64(racemap, index);
+            assert(error==MAP_OK);
+        }
+    }
+
+    __atomic_store_n(&race_done, 1, __ATOMIC_RELEASE);
+    pthread_join(reader, NULL);
+    assert(found > 0);
+
+    hashmap_free(racemap);
+}
+
 int main(char* argv, int argc)
 {
     int index;
@@ -60,6 +136,28 @@ int main(char* argv, int argc)
     /* Make sure the value was not found */
     assert(error==MAP_MISSING);
 
+    /* Iteration visits the values in insertion order */
+    index = 0;
+    error = hashmap_iterate(mymap, check_order, &index);
+    assert(error==MAP_OK);
+    assert(index==KEY_COUNT);
+
+    /* Integer and binary keys live next to string keys without clashing */
+    value = malloc(sizeof(data_struct_t));
+    value->number = -1;
+    error = hashmap_put_u64(mymap, 42, value);
+    assert(error==MAP_OK);
+    error = hashmap_get_u64(mymap, 42, (void**)(&value));
+    assert(error==MAP_OK && value->number==-1);
+    error = hashmap_get_bin(mymap, "somekey42", sizeof("somekey42") - 1, (void**)(&value));
+    assert(error==MAP_OK && value->number==42);
+    error = hashmap_get_u64(mymap, 43, (void**)(&value));
+    assert(error==MAP_MISSING);
+    error = hashmap_get_u64(mymap, 42, (void**)(&value));
+    error = hashmap_remove_u64(mymap, 42);
+    assert(error==MAP_OK);
+    free(value);
+
     /* Free all of the values we allocated and remove them from the map */
     for (index=0; index<KEY_COUNT; index+=1)
     {
@@ -77,5 +175,7 @@ int main(char* argv, int argc)
     /* Now, destroy the map */
     hashmap_free(mymap);
 
+    race_test();
+
     return 1;
 }
\ No newline at end of file
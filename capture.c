@@ -0,0 +1,141 @@
+/*
+    irmplircd -- zeroconf LIRC daemon that reads IRMP events from the USB IR Remote Receiver
+	             http://www.mikrocontroller.net/articles/USB_IR_Remote_Receiver
+    Copyright (C) 2011-2014  Dirk E. Wagner
+
+    This program is free software; you can redistribute it and/or modify it
+    under the terms of version 2 of the GNU General Public License as published
+    by the Free Software Foundation.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program; if not, write to the Free Software
+    Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301 USA
+*/
+
+ /* Standard headers */
+#include <stdio.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <string.h>
+#include <stddef.h>
+#include <errno.h>
+#include <syslog.h>
+#include <unistd.h>
+#include <sys/stat.h>
+
+#include "debug.h"
+#include "capture.h"
+#include "log.h"
+
+static bool buffered = false;
+static uint64_t buffered_us;	// time of the oldest record not flushed
+static bool replay_v1 = false;
+
+FILE *capture_create(const char *path, bool append) {
+	FILE *capture = fopen(path, append ? "ab" : "wb");
+	struct stat st;
+
+	if (!capture) {
+		fprintf(stderr, "Could not create capture file %s: %s\n", path, strerror(errno));
+		return NULL;
+	}
+
+	/* Appending continues the records of the file, its magic is there already */
+	if (append && !fstat(fileno(capture), &st) && st.st_size > 0)
+		return capture;
+
+	if (fwrite(CAPTURE_MAGIC, strlen(CAPTURE_MAGIC), 1, capture) != 1 || fflush(capture)) {
+		fprintf(stderr, "Could not write capture file %s: %s\n", path, strerror(errno));
+		fclose(capture);
+		return NULL;
+	}
+
+	return capture;
+}
+
+FILE *capture_adopt(int fd) {
+	FILE *capture = fdopen(fd, "ab");
+
+	if (!capture) {
+		fprintf(stderr, "Could not take over the capture file: %s\n", strerror(errno));
+		close(fd);
+	}
+	return capture;
+}
+
+bool capture_write(FILE *capture, uint64_t ts_us, int device, int layer, uint64_t sockets, const void *report) {
+	capture_record_t record;
+
+	record.ts_us = ts_us;
+	record.device = device;
+	record.layer = layer;
+	record.sockets = sockets;
+	memcpy(record.report, report, sizeof record.report);
+
+	if (fwrite(&record, sizeof record, 1, capture) != 1) {
+		LOG(LOG_ERR, "Error writing capture: %s", strerror(errno));
+		return false;
+	}
+
+	if (!buffered) {
+		buffered = true;
+		buffered_us = ts_us;
+	}
+	return true;
+}
+
+int capture_flush(FILE *capture, uint64_t now_us) {
+	uint64_t due = buffered_us + CAPTURE_FLUSH_MS * 1000;
+
+	if (!buffered)
+		return -1;
+
+	if (now_us < due)
+		return (due - now_us) / 1000 + 1;
+
+	buffered = false;
+	if (fflush(capture))
+		LOG(LOG_ERR, "Error writing capture: %s", strerror(errno));
+	return -1;
+}
+
+FILE *capture_open(const char *path) {
+	char magic[sizeof CAPTURE_MAGIC];
+	FILE *capture = fopen(path, "rb");
+
+	if (!capture) {
+		fprintf(stderr, "Could not open capture file %s: %s\n", path, strerror(errno));
+		return NULL;
+	}
+
+	if (fread(magic, strlen(CAPTURE_MAGIC), 1, capture) != 1 ||
+	    (memcmp(magic, CAPTURE_MAGIC, strlen(CAPTURE_MAGIC)) && memcmp(magic, CAPTURE_MAGIC_V1, strlen(CAPTURE_MAGIC_V1)))) {
+		fprintf(stderr, "%s is not an IRMP capture file\n", path);
+		fclose(capture);
+		return NULL;
+	}
+
+	replay_v1 = !memcmp(magic, CAPTURE_MAGIC_V1, strlen(CAPTURE_MAGIC_V1));
+	if (replay_v1)
+		LOG(LOG_INFO, "%s has no layers and sockets, replaying to all sockets", path);
+	return capture;
+}
+
+bool capture_read(FILE *capture, capture_record_t *record) {
+	if (!replay_v1)
+		return fread(record, sizeof *record, 1, capture) == 1;
+
+	/* Time and device, then the report */
+	if (fread(record, offsetof(capture_record_t, layer), 1, capture) != 1 ||
+	    fread(record->report, sizeof record->report, 1, capture) != 1)
+		return false;
+
+	record->layer = 0;
+	record->sockets = ~0ULL;
+	return true;
+}
@@ -0,0 +1,59 @@
+/*
+    irmplircd -- zeroconf LIRC daemon that reads IRMP events from the USB IR Remote Receiver
+	             http://www.mikrocontroller.net/articles/USB_IR_Remote_Receiver
+    Copyright (C) 2011-2014  Dirk E. Wagner
+
+    This program is free software; you can redistribute it and/or modify it
+    under the terms of version 2 of the GNU General Public License as published
+    by the Free Software Foundation.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program; if not, write to the Free Software
+    Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301 USA
+*/
+
+#ifndef __CAPTURE_H__
+#define __CAPTURE_H__
+
+#define CAPTURE_MAGIC            "IRMPCAP2"
+#define CAPTURE_MAGIC_V1         "IRMPCAP1"	/* without layer and sockets, still replayed */
+#define CAPTURE_REPORT_SIZE      (7)
+#define CAPTURE_FLUSH_MS         (1000)	/* longest a record stays buffered */
+
+/*
+ * A capture file is CAPTURE_MAGIC followed by fixed size records in host
+ * byte order: the monotonic time in us, the index of the device the report
+ * was read from, its translation table layer and socket mask and the raw
+ * IRMP report. Layers and sockets are numbered in the order of the -L and
+ * -d options, a replay needs the same ones to deliver reports like the
+ * capture did. Records of a CAPTURE_MAGIC_V1 file read as layer 0 and all
+ * sockets.
+ */
+typedef struct __attribute__ ((__packed__)) {
+	uint64_t ts_us;
+	uint8_t device;
+	uint8_t layer;
+	uint64_t sockets;
+	uint8_t report[CAPTURE_REPORT_SIZE];
+} capture_record_t;
+
+/*
+ * Records are buffered. capture_flush() writes them out once the oldest
+ * waited CAPTURE_FLUSH_MS and returns the ms until it has to run again,
+ * -1 if nothing is buffered. A crash loses at most that much. Appending to
+ * an existing file writes no second magic.
+ */
+FILE *capture_create(const char *path, bool append);
+FILE *capture_adopt(int fd);	// the file of the daemon we take over from
+bool capture_write(FILE *capture, uint64_t ts_us, int device, int layer, uint64_t sockets, const void *report);
+int capture_flush(FILE *capture, uint64_t now_us);
+
+FILE *capture_open(const char *path);
+bool capture_read(FILE *capture, capture_record_t *record);
+
+#endif
@@ -0,0 +1,362 @@
+/*
+    irmplircd -- zeroconf LIRC daemon that reads IRMP events from the USB IR Remote Receiver
+	             http://www.mikrocontroller.net/articles/USB_IR_Remote_Receiver
+    Copyright (C) 2011-2014  Dirk E. Wagner
+
+    This program is free software; you can redistribute it and/or modify it
+    under the terms of version 2 of the GNU General Public License as published
+    by the Free Software Foundation.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program; if not, write to the Free Software
+    Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301 USA
+*/
+
+ /* Standard headers */
+#include <stdio.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <string.h>
+#include <strings.h>
+#include <ctype.h>
+#include <errno.h>
+#include <signal.h>
+#include <sys/uio.h>
+
+#include "debug.h"
+#include "hashmap.h"
+#include "mapping.h"
+#include "log.h"
+#include "command.h"
+
+/* Everything after "BEGIN\n<command>\n", ready to send */
+typedef struct reply {
+	struct reply *next;
+	char *key;		// normalized command
+	size_t len;
+	char data[];
+} reply_t;
+
+/* Reverse index entry, the LIST lines of one key name in table order */
+typedef struct name {
+	char *name;
+	int nlines;
+	const char **lines;
+	struct name *next;
+} name_t;
+
+typedef struct {
+	map_t names;		// upper cased key name -> name_t
+	name_t *list;
+	char **lines;		// "<code> <name>" of every table entry
+	int nlines;
+} index_t;
+
+static map_t replies = NULL;		// upper cased normalized command -> reply_t
+static reply_t *reply_list = NULL;
+
+/* Remote and key names match regardless of case, like lircd */
+static void fold(char *s) {
+	for(; *s; s++)
+		*s = toupper((unsigned char) *s);
+}
+
+static reply_t *new_reply(const char *key, const char *status, int nlines, const char **lines) {
+	size_t len = strlen(status) + 6 + 4 + 20;	// status, DATA, END and the count
+	reply_t *reply;
+	char *p;
+	int i;
+
+	for(i = 0; i < nlines; i++)
+		len += strlen(lines[i]) + 1;
+
+	reply = malloc(sizeof *reply + len + 1);
+	if(!reply || !(reply->key = strdup(key))) {
+		free(reply);
+		return NULL;
+	}
+
+	p = reply->data + sprintf(reply->data, "%s\n", status);
+	if(nlines > 0) {
+		p += sprintf(p, "DATA\n%d\n", nlines);
+		for(i = 0; i < nlines; i++)
+			p += sprintf(p, "%s\n", lines[i]);
+	}
+	p += sprintf(p, "END\n");
+
+	reply->len = p - reply->data;
+	return reply;
+}
+
+static bool add_reply(reply_t **list, const char *key, int nlines, const char **lines) {
+	reply_t *reply = new_reply(key, "SUCCESS", nlines, lines);
+
+	if(!reply)
+		return false;
+
+	reply->next = *list;
+	*list = reply;
+	return true;
+}
+
+static int add_entry(any_t item, any_t data) {
+	index_t *index = item;
+	map_entry_t *map_entry = data;
+	size_t len = strcspn(map_entry->value, " \t\r\n");
+	char *line, *folded;
+	name_t *name;
+
+	/* The remote clients see is the global table of codes, device layers and the
+	 * wildcard and range rules, whose keys are not codes, are not listed */
+	if(map_entry->layer || map_entry->rule)
+		return MAP_OK;
+
+	line = malloc(strlen(map_entry->key) + len + 2);
+	if(!line)
+		return MAP_OMEM;
+	sprintf(line, "%s %.*s", map_entry->key, (int) len, map_entry->value);
+	index->lines[index->nlines++] = line;
+
+	/* KEY_a and KEY_A list the lines of both */
+	if(!(folded = strndup(map_entry->value, len)))
+		return MAP_OMEM;
+	fold(folded);
+
+	if(hashmap_get_bin(index->names, folded, len, (any_t *) &name) != MAP_OK) {
+		name = calloc(1, sizeof *name);
+		if(!name) {
+			free(folded);
+			return MAP_OMEM;
+		}
+		name->name = folded;
+		name->next = index->list;
+		index->list = name;
+		if(hashmap_put_bin(index->names, name->name, len, name) != MAP_OK)
+			return MAP_OMEM;
+	} else
+		free(folded);
+
+	name->lines = realloc(name->lines, (name->nlines + 1) * sizeof *name->lines);
+	if(!name->lines)
+		return MAP_OMEM;
+	name->lines[name->nlines++] = line;
+
+	return MAP_OK;
+}
+
+bool command_build(map_t mymap) {
+	const char *version[] = { "irmplircd" };
+	const char *remotes[] = { COMMAND_REMOTE };
+	index_t index = { hashmap_new(), NULL, calloc(hashmap_length(mymap) + 1, sizeof(char *)), 0 };
+	reply_t *fresh = NULL, *reply, *old;
+	char key[COMMAND_MAX_LENGTH];
+	name_t *name, *next;
+	bool ok = index.names && index.lines;
+	int i;
+
+	if(ok && hashmap_length(mymap) > 0)
+		ok = hashmap_iterate(mymap, add_entry, &index) == MAP_OK;
+
+	ok = ok && add_reply(&fresh, "VERSION", 1, version);
+	ok = ok && add_reply(&fresh, "LIST", 1, remotes);
+	ok = ok && add_reply(&fresh, "LIST " COMMAND_REMOTE, index.nlines, (const char **) index.lines);
+
+	for(name = index.list; ok && name; name = name->next) {
+		snprintf(key, sizeof key, "LIST " COMMAND_REMOTE " %s", name->name);
+		ok = add_reply(&fresh, key, name->nlines, name->lines);
+	}
+
+	for(name = index.list; name; name = next) {
+		next = name->next;
+		free(name->lines);
+		free(name->name);
+		free(name);
+	}
+	for(i = 0; i < index.nlines; i++)
+		free(index.lines[i]);
+	free(index.lines);
+	hashmap_free(index.names);
+
+	if(ok && !replies)
+		ok = (replies = hashmap_new_concurrent()) != NULL;
+
+	for(reply = fresh; ok && reply; reply = reply->next)
+		ok = hashmap_put_bin(replies, reply->key, strlen(reply->key), reply) == MAP_OK;
+
+	if(!ok) {
+		fprintf(stderr, "Unable to build LIRC command replies: %s\n", strerror(errno));
+		/* Entries already replaced may point into fresh, so keep it */
+		return false;
+	}
+
+	/* Drop commands that are gone, then wait for readers of the old replies */
+	for(old = reply_list; old; old = old->next)
+		if(hashmap_get_bin(replies, old->key, strlen(old->key), (any_t *) &reply) == MAP_OK && reply == old)
+			hashmap_remove_bin(replies, old->key, strlen(old->key));
+
+	hashmap_synchronize(replies);
+
+	while(reply_list) {
+		old = reply_list;
+		reply_list = old->next;
+		free(old->key);
+		free(old);
+	}
+	reply_list = fresh;
+
+	return true;
+}
+
+/* Like a broadcast, a client that cannot take the whole reply is dropped */
+static bool send_reply(int fd, const char *command, const char *data, size_t len) {
+	struct iovec iov[] = {
+		{ "BEGIN\n", 6 },
+		{ (char *) command, strlen(command) },
+		{ "\n", 1 },
+		{ (char *) data, len },
+	};
+	ssize_t total = iov[0].iov_len + iov[1].iov_len + iov[2].iov_len + iov[3].iov_len;
+	ssize_t written = writev(fd, iov, sizeof iov / sizeof *iov);
+
+	if(written == total)
+		return true;
+
+	if(written < 0)
+		LOG(LOG_DEBUG, "Unable to send reply to %d: %s", fd, strerror(errno));
+	else
+		LOG(LOG_DEBUG, "Short reply to %d, %zd of %zd bytes", fd, written, total);
+	return false;
+}
+
+/* Collapse white space and upper case the directive */
+static void normalize(const char *command, char *key, size_t size) {
+	size_t len = 0;
+	bool directive = true;
+
+	while(*command && len < size - 1) {
+		if(isspace((unsigned char) *command)) {
+			while(isspace((unsigned char) *command))
+				command++;
+			if(*command && len)
+				key[len++] = ' ';
+			directive = false;
+			continue;
+		}
+		key[len++] = directive ? toupper((unsigned char) *command) : *command;
+		command++;
+	}
+
+	key[len] = '\0';
+}
+
+int command_priority(const char *name) {
+	static const char *names[] = { "HIGH", "NORMAL", "IDLE" };
+	int i;
+
+	for(i = 0; i < sizeof names / sizeof *names; i++)
+		if(!strcasecmp(name, names[i]))
+			return i;
+
+	return -1;
+}
+
+/* Returns false if the reply could not be sent */
+static bool process_line(int fd, char *line, command_buffer_t *buffer) {
+	char key[COMMAND_MAX_LENGTH], folded[COMMAND_MAX_LENGTH];
+	char error[COMMAND_MAX_LENGTH + 64];
+	const char *message, *arg;
+	reply_t *reply;
+	size_t len;
+	int section, priority;
+	bool sent;
+
+	/* Trim, the command is echoed back as sent */
+	while(isspace((unsigned char) *line))
+		line++;
+	len = strlen(line);
+	while(len && isspace((unsigned char) line[len - 1]))
+		line[--len] = '\0';
+	if(!len)
+		return true;
+
+	normalize(line, key, sizeof key);
+	LOG(LOG_DEBUG, "command from %d: %s", fd, key);
+	strcpy(folded, key);
+	fold(folded);
+
+	if(!strcmp(key, "SIGHUP")) {
+		sent = send_reply(fd, line, "SUCCESS\nEND\n", 12);
+		kill(getpid(), SIGHUP);
+		return sent;
+	}
+
+	/* Not a lircd directive, clients declare their class with it */
+	if(!strncmp(key, "PRIORITY ", 9) && (priority = command_priority(key + 9)) >= 0) {
+		buffer->priority = priority;
+		return send_reply(fd, line, "SUCCESS\nEND\n", 12);
+	}
+
+	/* A reload frees replies once no section uses them anymore */
+	section = hashmap_read_lock(replies);
+	if(hashmap_get_bin(replies, folded, strlen(folded), (any_t *) &reply) == MAP_OK && reply) {
+		sent = send_reply(fd, line, reply->data, reply->len);
+		hashmap_read_unlock(replies, section);
+		return sent;
+	}
+	hashmap_read_unlock(replies, section);
+
+	/* Name the offending word like lircd does */
+	arg = key;
+	if(!strncmp(key, "LIST ", 5) && strncasecmp(key + 5, COMMAND_REMOTE " ", strlen(COMMAND_REMOTE) + 1) &&
+	   strcasecmp(key + 5, COMMAND_REMOTE)) {
+		message = "unknown remote";
+		arg = key + 5;
+	} else if(!strncmp(key, "LIST ", 5)) {
+		message = "unknown command";
+		arg = key + 6 + strlen(COMMAND_REMOTE);
+	} else if(!strncmp(key, "PRIORITY ", 9)) {
+		message = "unknown priority";
+		arg = key + 9;
+	} else
+		message = "unknown directive";
+
+	len = snprintf(error, sizeof error, "ERROR\nDATA\n1\n%s: \"%.*s\"\nEND\n", message, (int) strcspn(arg, " "), arg);
+	return send_reply(fd, line, error, len < sizeof error ? len : sizeof error - 1);
+}
+
+bool command_process(int fd, command_buffer_t *buffer) {
+	char *line, *eol;
+	ssize_t len;
+
+	while(true) {
+		len = read(fd, buffer->line + buffer->len, sizeof buffer->line - 1 - buffer->len);
+
+		if(len < 0)
+			return errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR;
+		if(len == 0)
+			return false;
+
+		buffer->len += len;
+		buffer->line[buffer->len] = '\0';
+
+		for(line = buffer->line; (eol = strchr(line, '\n')); line = eol + 1) {
+			*eol = '\0';
+			if(!process_line(fd, line, buffer))
+				return false;
+		}
+
+		buffer->len -= line - buffer->line;
+		memmove(buffer->line, line, buffer->len);
+
+		/* Nothing that long is a command */
+		if(buffer->len == sizeof buffer->line - 1)
+			buffer->len = 0;
+	}
+}
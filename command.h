@@ -0,0 +1,55 @@
+/*
+    irmplircd -- zeroconf LIRC daemon that reads IRMP events from the USB IR Remote Receiver
+	             http://www.mikrocontroller.net/articles/USB_IR_Remote_Receiver
+    Copyright (C) 2011-2014  Dirk E. Wagner
+
+    This program is free software; you can redistribute it and/or modify it
+    under the terms of version 2 of the GNU General Public License as published
+    by the Free Software Foundation.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program; if not, write to the Free Software
+    Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301 USA
+*/
+
+#ifndef __COMMAND_H__
+#define __COMMAND_H__
+
+#define COMMAND_MAX_LENGTH (128)
+#define COMMAND_REMOTE "IRMP"
+
+/* Client classes, broadcasts serve lower ones first and idle ones last */
+#define PRIORITY_HIGH      0
+#define PRIORITY_NORMAL    1
+#define PRIORITY_IDLE      2	/* deferred until nothing else is pending */
+
+/* Partial command line of a client and the class it is in */
+typedef struct {
+	char line[COMMAND_MAX_LENGTH];
+	int len;
+	int priority;		// set by PRIORITY HIGH|NORMAL|IDLE
+} command_buffer_t;
+
+/*
+ * Build the replies to VERSION, LIST, LIST IRMP and LIST IRMP <key> for a
+ * translation table. Replies are looked up by the fanout workers as well,
+ * so only the main thread may call this, again after a reload.
+ */
+bool command_build(map_t mymap);
+
+/* PRIORITY_ class by its name, case does not matter, -1 if there is none */
+int command_priority(const char *name);
+
+/*
+ * Read and answer the pending commands of a non-blocking client socket.
+ * A SIGHUP command raises SIGHUP, PRIORITY changes buffer->priority.
+ * Returns false if the client is gone or did not take a whole reply.
+ */
+bool command_process(int fd, command_buffer_t *buffer);
+
+#endif
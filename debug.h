@@ -27,7 +27,7 @@
 #ifdef DEBUG
 	#define DBG(x, ...) printf (x, ##__VA_ARGS__)
 #else
-	#define DBG(x...) {}
+	#define DBG(x...) do {} while (0)
 #endif
 
 #endif
@@ -0,0 +1,59 @@
+/*
+    irmplircd -- zeroconf LIRC daemon that reads IRMP events from the USB IR Remote Receiver
+	             http://www.mikrocontroller.net/articles/USB_IR_Remote_Receiver
+    Copyright (C) 2011-2014  Dirk E. Wagner
+
+    This program is free software; you can redistribute it and/or modify it
+    under the terms of version 2 of the GNU General Public License as published
+    by the Free Software Foundation.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program; if not, write to the Free Software
+    Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301 USA
+*/
+
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#include "dedup.h"
+
+typedef struct {
+	uint64_t key;
+	double time;
+	int device;
+} dedup_entry_t;
+
+static dedup_entry_t table[DEDUP_SLOTS];
+static int window = 0;
+
+void dedup_init(int ms) {
+	int i;
+
+	window = ms;
+	for(i = 0; i < DEDUP_SLOTS; i++)
+		table[i].device = -1;
+}
+
+bool dedup_active(void) {
+	return window > 0;
+}
+
+bool dedup_duplicate(uint64_t key, int device, double now) {
+	/* Fibonacci hashing mixes protocol, address and command into the middle bits */
+	dedup_entry_t *entry = &table[(key * 0x9e3779b97f4a7c15ULL) >> 32 & (DEDUP_SLOTS - 1)];
+
+	if(entry->key == key && entry->device != device && now - entry->time < window)
+		return true;
+
+	/* The first receiver keeps the key until it stops reporting it */
+	entry->key = key;
+	entry->time = now;
+	entry->device = device;
+	return false;
+}
@@ -0,0 +1,39 @@
+/*
+    irmplircd -- zeroconf LIRC daemon that reads IRMP events from the USB IR Remote Receiver
+	             http://www.mikrocontroller.net/articles/USB_IR_Remote_Receiver
+    Copyright (C) 2011-2014  Dirk E. Wagner
+
+    This program is free software; you can redistribute it and/or modify it
+    under the terms of version 2 of the GNU General Public License as published
+    by the Free Software Foundation.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program; if not, write to the Free Software
+    Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301 USA
+*/
+
+
+#ifndef __DEDUP_H__
+#define __DEDUP_H__
+
+#define DEDUP_SLOTS              (64)	/* must be a power of two */
+
+/*
+ * Suppress the copies of one IR frame caught by several receivers. A
+ * small direct mapped table remembers which device reported a key and
+ * flags last and when. The same report from another device within the
+ * window is a duplicate, from the same device it is a real repeat. A
+ * collision only lets a duplicate through. No locks, no allocation.
+ */
+void dedup_init(int window);
+bool dedup_active(void);
+
+/* key is IRMP_KEY() or'ed with the report flags */
+bool dedup_duplicate(uint64_t key, int device, double now);
+
+#endif
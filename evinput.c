@@ -0,0 +1,94 @@
+/*
+    irmplircd -- zeroconf LIRC daemon that reads IRMP events from the USB IR Remote Receiver
+	             http://www.mikrocontroller.net/articles/USB_IR_Remote_Receiver
+    Copyright (C) 2011-2014  Dirk E. Wagner
+
+    This program is free software; you can redistribute it and/or modify it
+    under the terms of version 2 of the GNU General Public License as published
+    by the Free Software Foundation.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program; if not, write to the Free Software
+    Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301 USA
+*/
+
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <string.h>
+#include <time.h>
+#include <sys/ioctl.h>
+
+#include "evinput.h"
+
+bool evinput_open(int fd, evinput_state_t *state) {
+	int version;
+	int clock = CLOCK_MONOTONIC;
+
+	if(ioctl(fd, EVIOCGVERSION, &version) < 0)
+		return false;
+
+	memset(state, 0, sizeof *state);
+	state->key = -1;
+	state->monotonic = ioctl(fd, EVIOCSCLOCKID, &clock) == 0;
+	return true;
+}
+
+bool evinput_match_ids(int fd, unsigned int vendor, unsigned int product) {
+	struct input_id id;
+
+	if(ioctl(fd, EVIOCGID, &id) < 0)
+		return false;
+
+	return id.vendor == vendor && id.product == product;
+}
+
+int evinput_decode(evinput_state_t *state, const struct input_event *events, int n, evinput_report_t *reports, double now) {
+	const struct input_event *event;
+	evinput_report_t *report;
+	uint32_t scancode;
+	int count = 0;
+
+	for(event = events; event < events + n; event++) {
+		switch(event->type) {
+			case EV_SYN:
+				state->scanned = false;
+				/* The kernel lost events, a repeat must not pick up a stale scancode */
+				if(event->code == SYN_DROPPED)
+					state->key = -1;
+				break;
+			case EV_MSC:
+				if(event->code == MSC_SCAN) {
+					state->scancode = event->value;
+					state->scanned = true;
+				}
+				break;
+			case EV_KEY:
+				if(event->value < 0 || event->value > 2)
+					break;
+				report = &reports[count++];
+				if(state->scanned || event->code == state->key) {
+					scancode = state->scanned ? state->scancode : state->key_scancode;
+					state->key = event->code;
+					state->key_scancode = scancode;
+					report->protocol = EVINPUT_PROTOCOL_SCAN;
+					report->address = scancode >> 16;
+					report->command = scancode;
+				} else {
+					report->protocol = EVINPUT_PROTOCOL_KEY;
+					report->address = 0;
+					report->command = event->code;
+				}
+				report->value = event->value;
+				report->time = state->monotonic ? (double) event->input_event_sec * 1000 + (double) event->input_event_usec / 1000 : now;
+				break;
+		}
+	}
+
+	return count;
+}
@@ -0,0 +1,66 @@
+/*
+    irmplircd -- zeroconf LIRC daemon that reads IRMP events from the USB IR Remote Receiver
+	             http://www.mikrocontroller.net/articles/USB_IR_Remote_Receiver
+    Copyright (C) 2011-2014  Dirk E. Wagner
+
+    This program is free software; you can redistribute it and/or modify it
+    under the terms of version 2 of the GNU General Public License as published
+    by the Free Software Foundation.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program; if not, write to the Free Software
+    Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301 USA
+*/
+
+
+
+#ifndef __EVINPUT_H__
+#define __EVINPUT_H__
+
+#include <linux/input.h>
+
+#define EVINPUT_BATCH            (64)	/* struct input_event per read() */
+#define EVINPUT_PROTOCOL_SCAN    0xfe	/* address and command are the high and low half of the scancode */
+#define EVINPUT_PROTOCOL_KEY     0xff	/* command is the key code, no scancode came with it */
+
+/*
+ * Native input source for receivers that show up as /dev/input/event*,
+ * like rc-core IR receivers and keyboards, next to the IRMP hidraw
+ * reports. Every EV_KEY press, autorepeat and release becomes a report
+ * of a pseudo protocol, so such receivers go through the same tables,
+ * repeat timing and filters. rc-core sends an EV_MSC MSC_SCAN before the
+ * key, its scancode is used when there is one. The time of a report is
+ * the kernel timestamp of the event, on the monotonic clock.
+ */
+typedef struct {
+	uint8_t protocol;
+	uint16_t address;
+	uint16_t command;
+	int value;		// 1 press, 2 autorepeat, 0 release
+	double time;		// ms
+} evinput_report_t;
+
+typedef struct {
+	uint32_t scancode;	// MSC_SCAN of the frame being read
+	bool scanned;
+	int key;		// last key with a scancode, repeats come without one
+	uint32_t key_scancode;
+	bool monotonic;		// timestamps are on CLOCK_MONOTONIC
+} evinput_state_t;
+
+/* Returns false if fd is not an event device, e.g. hidraw */
+bool evinput_open(int fd, evinput_state_t *state);
+bool evinput_match_ids(int fd, unsigned int vendor, unsigned int product);
+
+/*
+ * Turn n events from one read() into at most n reports. now stands in
+ * for the timestamps if the clock could not be switched to monotonic.
+ */
+int evinput_decode(evinput_state_t *state, const struct input_event *events, int n, evinput_report_t *reports, double now);
+
+#endif
@@ -0,0 +1,338 @@
+/*
+    irmplircd -- zeroconf LIRC daemon that reads IRMP events from the USB IR Remote Receiver
+	             http://www.mikrocontroller.net/articles/USB_IR_Remote_Receiver
+    Copyright (C) 2011-2014  Dirk E. Wagner
+
+    This program is free software; you can redistribute it and/or modify it
+    under the terms of version 2 of the GNU General Public License as published
+    by the Free Software Foundation.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program; if not, write to the Free Software
+    Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301 USA
+*/
+
+#define _GNU_SOURCE
+ /* Standard headers */
+#include <stdio.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <string.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <syslog.h>
+#include <sysexits.h>
+#include <signal.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+
+#include "debug.h"
+#include "hashmap.h"
+#include "fanout.h"
+#include "command.h"
+#include "log.h"
+
+typedef struct {
+	_Atomic uint64_t seq;	// published count it holds, SLOT_WRITING while it is rewritten
+	int len;
+	uint64_t sockets;	// bit n set if clients of socket n get it
+	char message[FANOUT_MESSAGE_SIZE];
+} fanout_slot_t;
+
+#define SLOT_WRITING             UINT64_MAX
+
+/* A client on its way to a worker, it gets the messages from since on */
+typedef struct {
+	fanout_client_t client;
+	uint64_t since;
+} fanout_join_t;
+
+typedef struct {
+	pthread_t thread;
+	int epfd;
+	int wakefd;		// eventfd, signalled for every published message
+	int clientpipe[2];	// new clients from the accepting thread
+	int *fds;		// dense array of our clients
+	int *sockets;		// socket each client connected to, parallel to fds
+	uint64_t *since;	// first message of each client, parallel to fds
+	command_buffer_t *commands;	// partial commands, parallel to fds
+	int nfds;
+	int size;
+	uint64_t consumed;	// next slot to send
+	uint64_t idle_consumed;	// next slot to send to the PRIORITY_IDLE clients
+} fanout_worker_t;
+
+static fanout_slot_t slots[FANOUT_SLOTS];
+static _Atomic uint64_t published = 0;
+static _Atomic int nclients = 0;
+static atomic_bool stopping = false;
+
+static fanout_worker_t *workers = NULL;
+static int nworkers = 0;
+static int next_worker = 0;
+
+static void worker_add_client(fanout_worker_t *worker, fanout_join_t join) {
+	struct epoll_event ev = { .events = EPOLLIN | EPOLLRDHUP, .data.fd = join.client.fd };
+
+	if (worker->nfds == worker->size) {
+		int size = worker->size ? 2 * worker->size : 16;
+		int *fds = realloc(worker->fds, size * sizeof *fds);
+		int *sockets = fds ? realloc(worker->sockets, size * sizeof *sockets) : NULL;
+		uint64_t *since = sockets ? realloc(worker->since, size * sizeof *since) : NULL;
+		command_buffer_t *commands = since ? realloc(worker->commands, size * sizeof *commands) : NULL;
+
+		if (fds)
+			worker->fds = fds;
+		if (sockets)
+			worker->sockets = sockets;
+		if (since)
+			worker->since = since;
+		if (!fds || !sockets || !since || !commands) {
+			LOG(LOG_ERR, "Could not allocate client array: %s", strerror(errno));
+			close(join.client.fd);
+			atomic_fetch_sub(&nclients, 1);
+			return;
+		}
+		worker->commands = commands;
+		worker->size = size;
+	}
+
+	worker->commands[worker->nfds].len = 0;
+	worker->commands[worker->nfds].priority = join.client.priority;
+	worker->sockets[worker->nfds] = join.client.socket;
+	worker->since[worker->nfds] = join.since;
+	worker->fds[worker->nfds++] = join.client.fd;
+	epoll_ctl(worker->epfd, EPOLL_CTL_ADD, join.client.fd, &ev);
+}
+
+static void worker_remove_client(fanout_worker_t *worker, int i) {
+	close(worker->fds[i]);	// also removes it from the epoll set
+	worker->fds[i] = worker->fds[--worker->nfds];
+	worker->sockets[i] = worker->sockets[worker->nfds];
+	worker->since[i] = worker->since[worker->nfds];
+	worker->commands[i] = worker->commands[worker->nfds];
+	atomic_fetch_sub(&nclients, 1);
+}
+
+/* Send the slots from *consumed on to the clients of the classes first to last, in that order */
+static void worker_send(fanout_worker_t *worker, uint64_t *consumed, int first, int last) {
+	uint64_t head = atomic_load_explicit(&published, memory_order_acquire);
+	fanout_slot_t *slot;
+	char message[FANOUT_MESSAGE_SIZE];
+	uint64_t sockets;
+	int len, i, priority;
+
+	if (head - *consumed > FANOUT_SLOTS) {
+		LOG(LOG_ERR, "fanout worker fell behind, %llu messages lost",
+			(unsigned long long) (head - *consumed - FANOUT_SLOTS));
+		*consumed = head - FANOUT_SLOTS;
+	}
+
+	for (; *consumed < head; (*consumed)++) {
+		slot = &slots[*consumed & (FANOUT_SLOTS - 1)];
+		if (atomic_load_explicit(&slot->seq, memory_order_acquire) != *consumed)
+			continue;
+
+		len = slot->len;
+		sockets = slot->sockets;
+		memcpy(message, slot->message, len);
+
+		/* Drop the copy if the reader started to reuse the slot while we took it */
+		atomic_thread_fence(memory_order_acquire);
+		if (atomic_load_explicit(&slot->seq, memory_order_relaxed) != *consumed)
+			continue;
+
+		for (priority = first; priority <= last; priority++)
+			for (i = 0; i < worker->nfds; i++) {
+				if (worker->commands[i].priority != priority || !(sockets & (1ULL << worker->sockets[i])))
+					continue;
+				/* Published before it connected, the worker was just behind */
+				if (*consumed < worker->since[i])
+					continue;
+				if (write(worker->fds[i], message, len) != len)
+					worker_remove_client(worker, i--);
+			}
+	}
+}
+
+static void *worker_main(void *arg) {
+	fanout_worker_t *worker = arg;
+	struct epoll_event events[16];
+	fanout_join_t join;
+	uint64_t count;
+	int i, j, n;
+
+	while (true) {
+		n = epoll_wait(worker->epfd, events, sizeof events / sizeof *events, -1);
+		if (n < 0) {
+			if (errno == EINTR)
+				continue;
+			syslog(LOG_ERR, "Error during epoll_wait(): %s\n", strerror(errno));
+			exit(EX_OSERR);
+		}
+
+		for (i = 0; i < n; i++) {
+			if (events[i].data.fd == worker->wakefd) {
+				if (read(worker->wakefd, &count, sizeof count) == sizeof count)
+					worker_send(worker, &worker->consumed, PRIORITY_HIGH, PRIORITY_NORMAL);
+			} else if (events[i].data.fd == worker->clientpipe[0]) {
+				while (read(worker->clientpipe[0], &join, sizeof join) == sizeof join)
+					worker_add_client(worker, join);
+			} else {
+				/* A command, or the client hung up and the next write would fail */
+				for (j = 0; j < worker->nfds; j++)
+					if (worker->fds[j] == events[i].data.fd) {
+						if (!command_process(worker->fds[j], &worker->commands[j]))
+							worker_remove_client(worker, j);
+						break;
+					}
+			}
+		}
+
+		if (atomic_load(&stopping)) {
+			while (read(worker->clientpipe[0], &join, sizeof join) == sizeof join)
+				worker_add_client(worker, join);
+			worker_send(worker, &worker->consumed, PRIORITY_HIGH, PRIORITY_NORMAL);
+			worker_send(worker, &worker->idle_consumed, PRIORITY_IDLE, PRIORITY_IDLE);
+			break;
+		}
+
+		/* Nothing else to do before the next wait */
+		worker_send(worker, &worker->idle_consumed, PRIORITY_IDLE, PRIORITY_IDLE);
+	}
+
+	return NULL;
+}
+
+bool fanout_start(int count) {
+	struct epoll_event ev = { .events = EPOLLIN };
+	fanout_worker_t *worker;
+	sigset_t all, old;
+	int i;
+
+	workers = calloc(count, sizeof *workers);
+	if (!workers)
+		return false;
+
+	for (i = 0; i < count; i++) {
+		worker = &workers[i];
+		/* Like a joining client, a worker starts at what is published now */
+		worker->consumed = worker->idle_consumed = atomic_load(&published);
+
+		worker->epfd = epoll_create1(EPOLL_CLOEXEC);
+		worker->wakefd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+		if (worker->epfd < 0 || worker->wakefd < 0 || pipe2(worker->clientpipe, O_NONBLOCK | O_CLOEXEC) < 0) {
+			fprintf(stderr, "Unable to set up fanout worker: %s\n", strerror(errno));
+			return false;
+		}
+
+		ev.data.fd = worker->wakefd;
+		epoll_ctl(worker->epfd, EPOLL_CTL_ADD, worker->wakefd, &ev);
+		ev.data.fd = worker->clientpipe[0];
+		epoll_ctl(worker->epfd, EPOLL_CTL_ADD, worker->clientpipe[0], &ev);
+
+		/* Signals are for the main loop, workers start with all of them blocked */
+		sigfillset(&all);
+		pthread_sigmask(SIG_SETMASK, &all, &old);
+		errno = pthread_create(&worker->thread, NULL, worker_main, worker);
+		pthread_sigmask(SIG_SETMASK, &old, NULL);
+		if (errno) {
+			fprintf(stderr, "Unable to start fanout worker: %s\n", strerror(errno));
+			return false;
+		}
+		nworkers++;
+	}
+
+	return true;
+}
+
+bool fanout_active(void) {
+	return nworkers > 0;
+}
+
+void fanout_add_client(int fd, int socket, int priority) {
+	fanout_worker_t *worker = &workers[next_worker];
+	fanout_join_t join = { { fd, socket, priority }, atomic_load_explicit(&published, memory_order_relaxed) };
+
+	next_worker = (next_worker + 1) % nworkers;
+	atomic_fetch_add(&nclients, 1);
+
+	/* Smaller than PIPE_BUF, so it arrives in one piece */
+	if (write(worker->clientpipe[1], &join, sizeof join) != sizeof join) {
+		LOG(LOG_ERR, "Unable to pass client to fanout worker: %s", strerror(errno));
+		close(fd);
+		atomic_fetch_sub(&nclients, 1);
+	}
+}
+
+int fanout_clients(void) {
+	return atomic_load(&nclients);
+}
+
+int fanout_stop(fanout_client_t **clients) {
+	fanout_worker_t *worker;
+	uint64_t one = 1;
+	int i, j, n = 0;
+
+	*clients = malloc((atomic_load(&nclients) + 1) * sizeof **clients);
+	atomic_store(&stopping, true);
+
+	for (i = 0; i < nworkers; i++)
+		if (write(workers[i].wakefd, &one, sizeof one) < 0)
+			LOG(LOG_ERR, "Unable to wake fanout worker: %s", strerror(errno));
+
+	for (i = 0; i < nworkers; i++) {
+		worker = &workers[i];
+		pthread_join(worker->thread, NULL);
+		for (j = 0; *clients && j < worker->nfds; j++, n++) {
+			(*clients)[n].fd = worker->fds[j];
+			(*clients)[n].socket = worker->sockets[j];
+			(*clients)[n].priority = worker->commands[j].priority;
+		}
+		close(worker->epfd);
+		close(worker->wakefd);
+		close(worker->clientpipe[0]);
+		close(worker->clientpipe[1]);
+		free(worker->fds);
+		free(worker->sockets);
+		free(worker->since);
+		free(worker->commands);
+	}
+
+	free(workers);
+	workers = NULL;
+	nworkers = 0;
+	return n;
+}
+
+void fanout_publish(const char *message, int len, uint64_t sockets) {
+	uint64_t head = atomic_load_explicit(&published, memory_order_relaxed);
+	fanout_slot_t *slot = &slots[head & (FANOUT_SLOTS - 1)];
+	uint64_t one = 1;
+	int i;
+
+	if (len > FANOUT_MESSAGE_SIZE)
+		len = FANOUT_MESSAGE_SIZE;
+
+	/* Workers still copying the old message see the change and drop it */
+	atomic_store_explicit(&slot->seq, SLOT_WRITING, memory_order_relaxed);
+	atomic_thread_fence(memory_order_release);
+	slot->len = len;
+	slot->sockets = sockets;
+	memcpy(slot->message, message, len);
+	atomic_store_explicit(&slot->seq, head, memory_order_release);
+	atomic_store_explicit(&published, head + 1, memory_order_release);
+
+	for (i = 0; i < nworkers; i++)
+		if (write(workers[i].wakefd, &one, sizeof one) < 0)
+			LOG(LOG_ERR, "Unable to wake fanout worker: %s", strerror(errno));
+}
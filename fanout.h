@@ -0,0 +1,57 @@
+/*
+    irmplircd -- zeroconf LIRC daemon that reads IRMP events from the USB IR Remote Receiver
+	             http://www.mikrocontroller.net/articles/USB_IR_Remote_Receiver
+    Copyright (C) 2011-2014  Dirk E. Wagner
+
+    This program is free software; you can redistribute it and/or modify it
+    under the terms of version 2 of the GNU General Public License as published
+    by the Free Software Foundation.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program; if not, write to the Free Software
+    Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301 USA
+*/
+
+#ifndef __FANOUT_H__
+#define __FANOUT_H__
+
+#define FANOUT_SLOTS             (64)	/* must be a power of two */
+#define FANOUT_MESSAGE_SIZE      (64)
+
+/*
+ * Sharded fanout: accepted clients are spread over worker threads, each
+ * with its own epoll set and client array. The reader publishes every
+ * message once into a shared ring of read-only slots and wakes the
+ * workers, which write it to their clients in parallel. A client gets
+ * the messages published after it was handed over. Each worker
+ * serves its PRIORITY_HIGH clients first and its PRIORITY_IDLE ones only
+ * once it has nothing else to do.
+ */
+bool fanout_start(int workers);
+bool fanout_active(void);
+
+typedef struct {
+	int fd;
+	int socket;		// index of the LIRC socket it connected to
+	int priority;		// PRIORITY_ class
+} fanout_client_t;
+
+/* Hand a connected, non-blocking client over to one of the workers */
+void fanout_add_client(int fd, int socket, int priority);
+int fanout_clients(void);
+
+/*
+ * Stop the workers once they sent what was published and return their
+ * clients in a malloc()ed array, for a handover. Returns the count.
+ */
+int fanout_stop(fanout_client_t **clients);
+
+/* Publish a message for the clients of the sockets set in the sockets mask */
+void fanout_publish(const char *message, int len, uint64_t sockets);
+
+#endif
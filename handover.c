@@ -0,0 +1,106 @@
+/*
+    irmplircd -- zeroconf LIRC daemon that reads IRMP events from the USB IR Remote Receiver
+	             http://www.mikrocontroller.net/articles/USB_IR_Remote_Receiver
+    Copyright (C) 2011-2014  Dirk E. Wagner
+
+    This program is free software; you can redistribute it and/or modify it
+    under the terms of version 2 of the GNU General Public License as published
+    by the Free Software Foundation.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program; if not, write to the Free Software
+    Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301 USA
+*/
+
+
+#include <stdio.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <unistd.h>
+#include <string.h>
+#include <errno.h>
+#include <sys/socket.h>
+#include <sys/uio.h>
+
+#include "handover.h"
+
+bool handover_send(int sock, handover_type_t type, int index, const void *data, int len, const int *fds, int nfds) {
+	handover_message_t message;
+	char control[CMSG_SPACE(HANDOVER_MAX_FDS * sizeof(int))];
+	struct iovec iov;
+	struct msghdr msg;
+	struct cmsghdr *cmsg;
+
+	if(len > HANDOVER_DATA_SIZE || nfds > HANDOVER_MAX_FDS) {
+		errno = EMSGSIZE;
+		return false;
+	}
+
+	memset(&message, 0, sizeof message);
+	message.type = type;
+	message.index = index;
+	message.len = len;
+	if(len)
+		memcpy(message.data, data, len);
+
+	iov.iov_base = &message;
+	iov.iov_len = sizeof message - HANDOVER_DATA_SIZE + len;
+
+	memset(&msg, 0, sizeof msg);
+	msg.msg_iov = &iov;
+	msg.msg_iovlen = 1;
+
+	if(nfds) {
+		memset(control, 0, sizeof control);
+		msg.msg_control = control;
+		msg.msg_controllen = CMSG_SPACE(nfds * sizeof(int));
+		cmsg = CMSG_FIRSTHDR(&msg);
+		cmsg->cmsg_level = SOL_SOCKET;
+		cmsg->cmsg_type = SCM_RIGHTS;
+		cmsg->cmsg_len = CMSG_LEN(nfds * sizeof(int));
+		memcpy(CMSG_DATA(cmsg), fds, nfds * sizeof(int));
+	}
+
+	while(sendmsg(sock, &msg, MSG_NOSIGNAL) < 0)
+		if(errno != EINTR)
+			return false;
+
+	return true;
+}
+
+int handover_receive(int sock, handover_message_t *message, int *fds) {
+	char control[CMSG_SPACE(HANDOVER_MAX_FDS * sizeof(int))];
+	struct iovec iov = { message, sizeof *message };
+	struct msghdr msg;
+	struct cmsghdr *cmsg;
+	ssize_t len;
+	int nfds = 0;
+
+	memset(&msg, 0, sizeof msg);
+	msg.msg_iov = &iov;
+	msg.msg_iovlen = 1;
+	msg.msg_control = control;
+	msg.msg_controllen = sizeof control;
+
+	while((len = recvmsg(sock, &msg, MSG_CMSG_CLOEXEC)) < 0)
+		if(errno != EINTR)
+			return -1;
+
+	if(len < (ssize_t) (sizeof *message - HANDOVER_DATA_SIZE) || message->len < 0 || message->len > HANDOVER_DATA_SIZE) {
+		errno = len ? EPROTO : ECONNRESET;
+		return -1;
+	}
+
+	for(cmsg = CMSG_FIRSTHDR(&msg); cmsg; cmsg = CMSG_NXTHDR(&msg, cmsg))
+		if(cmsg->cmsg_level == SOL_SOCKET && cmsg->cmsg_type == SCM_RIGHTS) {
+			nfds = (cmsg->cmsg_len - CMSG_LEN(0)) / sizeof(int);
+			memcpy(fds, CMSG_DATA(cmsg), nfds * sizeof(int));
+		}
+
+	return nfds;
+}
@@ -0,0 +1,56 @@
+/*
+    irmplircd -- zeroconf LIRC daemon that reads IRMP events from the USB IR Remote Receiver
+	             http://www.mikrocontroller.net/articles/USB_IR_Remote_Receiver
+    Copyright (C) 2011-2014  Dirk E. Wagner
+
+    This program is free software; you can redistribute it and/or modify it
+    under the terms of version 2 of the GNU General Public License as published
+    by the Free Software Foundation.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program; if not, write to the Free Software
+    Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301 USA
+*/
+
+
+#ifndef __HANDOVER_H__
+#define __HANDOVER_H__
+
+#define HANDOVER_ENV             "IRMPLIRCD_HANDOVER"
+#define HANDOVER_MAX_FDS         (250)	/* per message, the kernel takes at most 253 */
+#define HANDOVER_DATA_SIZE       (256)
+
+/*
+ * Upgrade without a gap: the running daemon starts the new binary with
+ * one end of a SOCK_SEQPACKET pair in HANDOVER_ENV. Once the new one is
+ * ready it sends HANDOVER_READY. The old one stops reading, passes its
+ * descriptors with SCM_RIGHTS, one message per kind, and exits.
+ */
+typedef enum {
+	HANDOVER_READY,
+	HANDOVER_SOCKET,	// the listening socket
+	HANDOVER_DEVICE,	// a receiver, index and path
+	HANDOVER_CLIENTS,	// up to HANDOVER_MAX_FDS clients of one socket, data holds their classes
+	HANDOVER_UINPUT,	// the uinput device, data holds its key bits
+	HANDOVER_CAPTURE,	// the capture file, flushed
+	HANDOVER_DONE
+} handover_type_t;
+
+typedef struct {
+	int type;
+	int index;
+	int len;
+	char data[HANDOVER_DATA_SIZE];
+} handover_message_t;
+
+bool handover_send(int sock, handover_type_t type, int index, const void *data, int len, const int *fds, int nfds);
+
+/* Blocks for the next message, returns the number of fds or -1 */
+int handover_receive(int sock, handover_message_t *message, int *fds);
+
+#endif
@@ -0,0 +1,125 @@
+/*
+    irmplircd -- zeroconf LIRC daemon that reads IRMP events from the USB IR Remote Receiver
+	             http://www.mikrocontroller.net/articles/USB_IR_Remote_Receiver
+    Copyright (C) 2011-2014  Dirk E. Wagner
+
+    This program is free software; you can redistribute it and/or modify it
+    under the terms of version 2 of the GNU General Public License as published
+    by the Free Software Foundation.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program; if not, write to the Free Software
+    Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301 USA
+*/
+
+ /* Standard headers */
+#include <stdio.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <unistd.h>
+#include <string.h>
+#include <errno.h>
+#include <syslog.h>
+#include <sys/socket.h>
+#include <sys/inotify.h>
+#include <linux/netlink.h>
+
+#include "debug.h"
+#include "hotplug.h"
+#include "log.h"
+
+static bool use_netlink = false;
+
+static int open_netlink(void) {
+	struct sockaddr_nl sa = {
+		.nl_family = AF_NETLINK,
+		.nl_groups = 1,		// kernel uevents
+	};
+	int fd = socket(AF_NETLINK, SOCK_DGRAM | SOCK_NONBLOCK | SOCK_CLOEXEC, NETLINK_KOBJECT_UEVENT);
+
+	if (fd < 0)
+		return -1;
+
+	if (bind(fd, (struct sockaddr *) &sa, sizeof sa) < 0) {
+		close(fd);
+		return -1;
+	}
+
+	return fd;
+}
+
+static int open_inotify(void) {
+	int fd = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+
+	if (fd < 0)
+		return -1;
+
+	if (inotify_add_watch(fd, "/dev", IN_CREATE | IN_ATTRIB | IN_MOVED_TO) < 0) {
+		close(fd);
+		return -1;
+	}
+
+	/* Event devices appear in there, a system without any may lack it */
+	if (inotify_add_watch(fd, "/dev/input", IN_CREATE | IN_ATTRIB | IN_MOVED_TO) < 0)
+		syslog(LOG_INFO, "Not watching /dev/input: %s\n", strerror(errno));
+
+	return fd;
+}
+
+int hotplug_open(void) {
+	int fd = open_netlink();
+
+	if (fd >= 0) {
+		use_netlink = true;
+		return fd;
+	}
+
+	syslog(LOG_INFO, "uevent netlink not available (%s), watching /dev instead\n", strerror(errno));
+
+	fd = open_inotify();
+	if (fd < 0)
+		syslog(LOG_ERR, "Unable to watch /dev: %s\n", strerror(errno));
+
+	return fd;
+}
+
+/* A uevent is "action@devpath" followed by NUL separated KEY=value pairs */
+static bool uevent_is_add(const char *buf, int len) {
+	const char *p;
+	bool add = false, subsystem = false;
+
+	for (p = buf; p < buf + len; p += strlen(p) + 1) {
+		if (!strcmp(p, "ACTION=add") || !strcmp(p, "ACTION=change"))
+			add = true;
+		else if (!strcmp(p, "SUBSYSTEM=hidraw") || !strcmp(p, "SUBSYSTEM=input"))
+			subsystem = true;
+	}
+
+	return add && subsystem;
+}
+
+bool hotplug_process(int fd) {
+	char buf[8192] __attribute__ ((aligned(__alignof__(struct inotify_event))));
+	bool added = false;
+	int len;
+
+	while ((len = read(fd, buf, sizeof buf - 1)) > 0 || (len < 0 && errno == EINTR)) {
+		if (len <= 0)
+			continue;
+
+		buf[len] = '\0';
+
+		/* Any change in /dev may be one of our devices, let the caller rescan */
+		if (!use_netlink || uevent_is_add(buf, len)) {
+			LOG(LOG_DEBUG, "hotplug: %s", use_netlink ? buf : "change in /dev");
+			added = true;
+		}
+	}
+
+	return added;
+}
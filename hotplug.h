@@ -0,0 +1,33 @@
+/*
+    irmplircd -- zeroconf LIRC daemon that reads IRMP events from the USB IR Remote Receiver
+	             http://www.mikrocontroller.net/articles/USB_IR_Remote_Receiver
+    Copyright (C) 2011-2014  Dirk E. Wagner
+
+    This program is free software; you can redistribute it and/or modify it
+    under the terms of version 2 of the GNU General Public License as published
+    by the Free Software Foundation.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program; if not, write to the Free Software
+    Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301 USA
+*/
+
+#ifndef __HOTPLUG_H__
+#define __HOTPLUG_H__
+
+/*
+ * Returns a descriptor that becomes readable when devices appear: a kernel
+ * uevent netlink socket, or an inotify watch on /dev and /dev/input if
+ * netlink is not available. Returns -1 on failure.
+ */
+int hotplug_open(void);
+
+/* Drain the descriptor, returns true if devices may have been added */
+bool hotplug_process(int fd);
+
+#endif
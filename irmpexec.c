@@ -48,150 +48,323 @@
 
 #include <sys/poll.h>
 #include <sys/file.h>
+#include <sys/inotify.h>
+#include <time.h>
 
 #include "debug.h"
-#include "hashmap.h"
-#include "mapping.h"
+#include "sequence.h"
+
+#define BACKOFF_MIN_MS           5
+#define BACKOFF_MAX_MS           3000
 
 static int lirc_fd = -1;
-static map_t mymap;
+static bool lirc_connecting = false;
+static int inotify_fd = -1;
+static sequence_table_t *sequences;
 //static const char RemoteName[] = "IRMP-exec";
 
+static int backoff_ms = BACKOFF_MIN_MS;
+static uint64_t reconnect_at = 0;
+
+static char lircbuf[BUFSIZ];
+static size_t lircbuf_len = 0;
+
 static struct sockaddr_un sa= {
 	.sun_family = AF_UNIX,
 	.sun_path = "/var/run/lirc/lircd"
 };
 
+/* returns monotonic time in ms */
+static uint64_t getTime_ms(void) {
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t) ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+}
+
+static void close_unixsocket(void) {
+	if (lirc_fd >= 0)
+		close(lirc_fd);
+	lirc_fd = -1;
+	lirc_connecting = false;
+	lircbuf_len = 0;
+}
+
+/*
+ * Start a non-blocking connect. Returns false if the daemon is not there
+ * (yet), true if we are connected or the connect is still in progress.
+ */
 static bool add_unixsocket(void) {
-	lirc_fd = socket(AF_UNIX, SOCK_STREAM, 0);
+	lirc_fd = socket(AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
 	if (lirc_fd < 0) {
 		syslog (LOG_ERR, "Unable to create an AF_UNIX socket: %s", strerror(errno)); 
 		return false;
 	}
-	
-	fcntl (lirc_fd, F_SETFL, fcntl (lirc_fd, F_GETFL, 0));
 
 	if (connect (lirc_fd, (struct sockaddr*)&sa, sizeof(sa)) < 0) {
-		syslog (LOG_ERR, "Unable to connect AF_UNIX socket %s: %s", sa.sun_path, strerror(errno));
-		close(lirc_fd);
-		lirc_fd = -1;
+		if (errno == EINPROGRESS) {
+			lirc_connecting = true;
+			return true;
+		}
+		/* On AF_UNIX EAGAIN means the listen backlog is full, retry with backoff */
+		DBG ("Unable to connect AF_UNIX socket %s: %s\n", sa.sun_path, strerror(errno));
+		close_unixsocket();
 		return false;
 	}
-	
+
+	lirc_connecting = false;
 	return true;
 }
 
-static int file_ready(int FileDes, int TimeoutMs) {
-	fd_set set;
-	struct timeval timeout;
-	FD_ZERO(&set);
-	FD_SET(FileDes, &set);
-	if (TimeoutMs >= 0) {
-		if (TimeoutMs < 100)
-       			TimeoutMs = 100;
-		timeout.tv_sec  = TimeoutMs / 1000;
-		timeout.tv_usec = (TimeoutMs % 1000) * 1000;
-     	}
-	return select (FD_SETSIZE, &set, NULL, NULL, (TimeoutMs >= 0) ? &timeout : NULL) > 0 && FD_ISSET(FileDes, &set);
+static void connected(void) {
+	syslog (LOG_INFO, "Connected to LIRC");
+	backoff_ms = BACKOFF_MIN_MS;
+	reconnect_at = 0;
 }
 
-static int safe_read(int filedes, void *buffer, int size) {
-	for (;;) {
-		int p = read(filedes, buffer, size);
-		if (p < 0 && errno == EINTR) {
-			syslog (LOG_ERR, "EINTR while reading from file handle %d - retrying", filedes);
-			continue;
-		}
-		return p;
+/* Exponential backoff with jitter: wait somewhere in [backoff/2, backoff] */
+static void schedule_reconnect(void) {
+	int delay = backoff_ms / 2 + rand() % (backoff_ms / 2 + 1);
+
+	reconnect_at = getTime_ms() + delay;
+	DBG ("reconnect in %d ms\n", delay);
+
+	backoff_ms *= 2;
+	if (backoff_ms > BACKOFF_MAX_MS)
+		backoff_ms = BACKOFF_MAX_MS;
+}
+
+static void try_reconnect(void) {
+	if (add_unixsocket()) {
+		if (!lirc_connecting)
+			connected();
+	} else {
+		schedule_reconnect();
 	}
 }
 
-static int wait_for_keycode (char *lircbuf) {
+static void connection_broken(void) {
+	syslog (LOG_ERR, "LIRC connection broken. Try to reconnect");
+	close_unixsocket();
+	backoff_ms = BACKOFF_MIN_MS;
+	try_reconnect();
+}
 
-	int size = -1;
-	int ready = 0;
-	
-	ready = file_ready(lirc_fd, -1);
+/* Watch the directory of the socket so we notice the daemon recreating it */
+static bool add_inotify(void) {
+	char dir[sizeof sa.sun_path];
 
-	size = ready ? safe_read (lirc_fd, lircbuf, BUFSIZ) : -1;
-	
-//	DBG ("ready=%d size=%d\n", ready, size);
-		
-	if (ready && size <= 0) {
-		syslog (LOG_ERR, "LIRC connection broken. Try to reconnect");
-		close(lirc_fd);
-		lirc_fd = -1;
-		while (lirc_fd < 0) {
-			sleep (3);
-			if (add_unixsocket()) {
-				syslog (LOG_INFO, "Reconnected to LIRC\n");
-				break;
-			}
+	snprintf(dir, sizeof dir, "%s", sa.sun_path);
+
+	inotify_fd = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+	if (inotify_fd < 0) {
+		syslog (LOG_ERR, "Unable to initialize inotify: %s", strerror(errno));
+		return false;
+	}
+
+	if (inotify_add_watch(inotify_fd, dirname(dir), IN_CREATE | IN_ATTRIB | IN_MOVED_TO) < 0) {
+		syslog (LOG_ERR, "Unable to watch %s: %s", dir, strerror(errno));
+		close(inotify_fd);
+		inotify_fd = -1;
+		return false;
+	}
+
+	return true;
+}
+
+static void processinotify(void) {
+	char buf[4096] __attribute__ ((aligned(__alignof__(struct inotify_event))));
+	char path[sizeof sa.sun_path];
+	const struct inotify_event *ev;
+	bool created = false;
+	const char *name;
+	ssize_t len;
+	char *p;
+
+	snprintf(path, sizeof path, "%s", sa.sun_path);
+	name = basename(path);
+
+	while ((len = read(inotify_fd, buf, sizeof buf)) > 0) {
+		for (p = buf; p < buf + len; p += sizeof(struct inotify_event) + ev->len) {
+			ev = (const struct inotify_event *) p;
+			if (ev->len && strcmp(ev->name, name) == 0)
+				created = true;
 		}
-	} else 
+	}
 
-	if (ready && size > 0) {
-		lircbuf [size-1] = '\0';
+	if (created && lirc_fd < 0) {
+		DBG ("%s appeared, reconnecting\n", sa.sun_path);
+		backoff_ms = BACKOFF_MIN_MS;
+		try_reconnect();
 	}
+}
 
-	return size;
+static int safe_read(int filedes, void *buffer, int size) {
+	for (;;) {
+		int p = read(filedes, buffer, size);
+		if (p < 0 && errno == EINTR) {
+			syslog (LOG_ERR, "EINTR while reading from file handle %d - retrying", filedes);
+			continue;
+		}
+		return p;
+	}
 }
 
 static void print_help() {
 
-	printf ("irmpexec [-w] [-d socket] [-f] [-u username] [-t path]\n\n");
+	printf ("irmpexec [-w] [-i] [-d socket] [-f] [-u username] [-t path]\n\n");
 	printf ("Options: \n");
 	printf ("\t-d <socket> UNIX socket. The default is /var/run/lirc/lircd.\n");
 	printf ("\t-f Run in the foreground.\n");
 	printf ("\t-u <user> User name.\n");
 	printf ("\t-t <path> Path to translation table.\n");
 	printf ("\t-w lirc irw like mode, print data.\n");
+	printf ("\t-i Watch the socket with inotify and reconnect as soon as it reappears.\n");
 	
 }
 
-static void main_loop(bool irw_mode) {
+static void execute(const char *action) {
+	syslog(LOG_INFO, "executing by IRMP (%s)", action);
+	system (action);
+}
+
+/* Run what a held back sequence left behind, once it is due */
+static void expire_sequences(void) {
+	const char *action;
+
+	while ((action = sequence_expire(sequences, getTime_ms())))
+		execute(action);
+}
+
+static void processline(char *line, bool irw_mode) {
 
 	int repeat = 0;
-	int bufSize = 0;
-	char lircbuf[BUFSIZ] = "";
 	char irmp_data[BUFSIZ] = "";
 	char irmp_code[BUFSIZ] = "";
 	char id[BUFSIZ] = ""; 
-	
+
+	if (sscanf (line, "%s %d %s %s", irmp_data, &repeat, irmp_code, id) != 4)
+		return;
+
+	DBG ("irmpdata=%s repeat=%d irmp_code=%s id=%s\n", irmp_data, repeat, irmp_code, id);
+	if (strncasecmp (id, "IRMP", 4) == 0) {
+		if (irw_mode) {
+			printf ("%s\t|%d\t|%s\t|%s\n", irmp_data, repeat, irmp_code, id);
+		} else {
+			const char *action = sequence_feed(sequences, irmp_code, repeat, getTime_ms());
+
+			if (action) {
+				DBG ("MAP_OK irmp_code=%s action=%s\n", irmp_code, action);
+				execute(action);
+			} else {
+				DBG ("no action irmp_code=%s repeat=%d\n", irmp_code, repeat);
+			}
+			expire_sequences();
+		}
+	} else {
+		DBG ("Wrong ID %s, code ignored\n", id);
+	}
+}
+
+static void processlirc(bool irw_mode) {
+	char *line, *eol;
+	int size;
+
+	if (lirc_connecting) {
+		int err = 0;
+		socklen_t errlen = sizeof err;
+
+		if (getsockopt(lirc_fd, SOL_SOCKET, SO_ERROR, &err, &errlen) < 0 || err) {
+			DBG ("connect failed: %s\n", strerror(err));
+			close_unixsocket();
+			schedule_reconnect();
+			return;
+		}
+		lirc_connecting = false;
+		connected();
+		return;
+	}
+
+	size = safe_read (lirc_fd, lircbuf + lircbuf_len, sizeof lircbuf - 1 - lircbuf_len);
+	if (size < 0 && (errno == EAGAIN || errno == EWOULDBLOCK))
+		return;
+
+	if (size <= 0) {
+		connection_broken();
+		return;
+	}
+
+	lircbuf_len += size;
+	lircbuf[lircbuf_len] = '\0';
+
+	/* A read may carry several messages, or only part of one */
+	for (line = lircbuf; (eol = strchr(line, '\n')); line = eol + 1) {
+		*eol = '\0';
+		processline(line, irw_mode);
+	}
+
+	lircbuf_len -= line - lircbuf;
+	if (lircbuf_len == sizeof lircbuf - 1)
+		lircbuf_len = 0;
+	memmove(lircbuf, line, lircbuf_len);
+}
+
+static int min_timeout(int a, int b) {
+	if (a < 0)
+		return b;
+	if (b < 0)
+		return a;
+	return a < b ? a : b;
+}
+
+static void main_loop(bool irw_mode) {
+
+	struct pollfd pfd[2];
+	int nfds, timeout;
+	uint64_t now;
+
 	if (irw_mode) {
 		printf ("irmpdata\t|repeat\t|irmp_codes\t|id\n"); 
 	}
 
 	do {
-		memset(&lircbuf, 0, sizeof(lircbuf));
-		if ((bufSize = wait_for_keycode (lircbuf)) > 0) {
-			sscanf (lircbuf, "%s %d %s %s", irmp_data, &repeat, irmp_code, id);
-			DBG ("irmpdata=%s repeat=%d irmp_code=%s id=%s\n", irmp_data, repeat, irmp_code, id);
-			if (strncasecmp (id, "IRMP", 4) == 0) {
-				if (irw_mode) {
-					printf ("%s\t|%d\t|%s\t|%s\n", irmp_data, repeat, irmp_code, id);
-				} else {
-					if (!repeat) {
-
-						map_entry_t *map_entry;
-			
-						if(hashmap_get(mymap, irmp_code, (void**)(&map_entry))==MAP_OK) {
-							DBG ("MAP_OK map_entry->irmp_code=%s map_entry->value=%s\n", map_entry->key, map_entry->value);	
-							syslog(LOG_INFO, "executing by IRMP (%s)", map_entry->value);
-							system (map_entry->value);
-						} else {
-							DBG ("MAP_ERROR irmp_code=%s|\n", irmp_code);	
-						}
-
-					} else {
-						DBG ("Repetition ignored\n");
-					}
-				}
-			} else {
-				DBG ("Wrong ID %s, code ignored\n", id);
-			}
-			
+		nfds = 0;
+		timeout = -1;
+
+		if (lirc_fd >= 0) {
+			pfd[nfds].fd = lirc_fd;
+			pfd[nfds].events = lirc_connecting ? POLLOUT : POLLIN;
+			nfds++;
+		} else {
+			now = getTime_ms();
+			timeout = reconnect_at > now ? reconnect_at - now : 0;
+		}
+
+		if (!irw_mode) {
+			expire_sequences();
+			timeout = min_timeout(timeout, sequence_wait(sequences, getTime_ms()));
+		}
+
+		if (inotify_fd >= 0) {
+			pfd[nfds].fd = inotify_fd;
+			pfd[nfds].events = POLLIN;
+			nfds++;
 		}
+
+		if (poll(pfd, nfds, timeout) < 0) {
+			if (errno == EINTR)
+				continue;
+			syslog (LOG_ERR, "Error during poll(): %s", strerror(errno));
+			exit(EX_OSERR);
+		}
+
+		if (inotify_fd >= 0 && (pfd[nfds - 1].revents & POLLIN))
+			processinotify();
+
+		if (lirc_fd >= 0 && pfd[0].fd == lirc_fd && pfd[0].revents)
+			processlirc(irw_mode);
+		else if (lirc_fd < 0 && getTime_ms() >= reconnect_at)
+			try_reconnect();
 	} while (true);
 
 }
@@ -203,8 +376,9 @@ int main(int argc, char *argv[]) {
 	int opt;
 	bool foreground = false;
 	bool irw_mode = false;
+	bool watch_socket = false;
 
-	while ((opt = getopt(argc, argv, "whd:fu:t:")) != -1) {
+	while ((opt = getopt(argc, argv, "whid:fu:t:")) != -1) {
         	switch (opt) {
 			case 'd':
 				strncpy (sa.sun_path, optarg, sizeof sa.sun_path - 1); 
@@ -218,6 +392,9 @@ int main(int argc, char *argv[]) {
 			case 't':
 				translation_path = strdup (optarg);
 				break;
+			case 'i':
+				watch_socket = true;
+				break;
 			case 'w':
 				irw_mode = true;
 				foreground = true;
@@ -231,30 +408,40 @@ int main(int argc, char *argv[]) {
         	}
     	}
 
-	mymap = hashmap_new();
+	sequences = sequence_table_new();
 	
-	if (!parse_translation_table(translation_path, mymap)) {
-		hashmap_free(mymap);
+	if (!sequences || !parse_sequence_table(translation_path, sequences)) {
+		sequence_table_free(sequences);
 		return EX_OSERR;
 	}
 
-	if (!add_unixsocket()) {
-		hashmap_free(mymap);
-		if (lirc_fd >= 0) close(lirc_fd);
+	srand(getpid() ^ getTime_ms());
+
+	if (watch_socket && !add_inotify()) {
+		sequence_table_free(sequences);
 		return EX_OSERR;
 	}
 
+	if (!add_unixsocket()) {
+		syslog (LOG_ERR, "Unable to connect AF_UNIX socket %s: %s, retrying", sa.sun_path, strerror(errno));
+		schedule_reconnect();
+	} else if (!lirc_connecting) {
+		connected();
+	}
+
 	struct passwd *pwd = getpwnam(user);
 	if(!pwd) {
-		hashmap_free(mymap);
-		if (lirc_fd >= 0) close(lirc_fd);
+		sequence_table_free(sequences);
+		close_unixsocket();
+		if (inotify_fd >= 0) close(inotify_fd);
 		fprintf(stderr, "Unable to resolve user %s!\n", user);
 		return EX_OSERR;
 	}
 
 	if(setgid(pwd->pw_gid) || setuid(pwd->pw_uid)) {
-		hashmap_free(mymap);
-		if (lirc_fd >= 0) close(lirc_fd);
+		sequence_table_free(sequences);
+		close_unixsocket();
+		if (inotify_fd >= 0) close(inotify_fd);
 		fprintf(stderr, "Unable to setuid/setguid to %s!\n", user);
 		return EX_OSERR;
 	}
@@ -268,9 +455,10 @@ int main(int argc, char *argv[]) {
 
 	main_loop(irw_mode);
 
-	/* Now, destroy the map */
-	hashmap_free(mymap);
-	if (lirc_fd >= 0) close(lirc_fd);
+	/* Now, destroy the sequences */
+	sequence_table_free(sequences);
+	close_unixsocket();
+	if (inotify_fd >= 0) close(inotify_fd);
 	
 	return 0;
 }
@@ -30,10 +30,12 @@
 #include <string.h>
 #include <libgen.h>
 #include <sys/ioctl.h>
+#include <poll.h>
 #include <sys/types.h>
 #include <sys/socket.h>
 #include <sys/un.h>
 #include <sys/time.h>
+#include <time.h>
 #include <sysexits.h>
 #include <sys/stat.h>
 #include <fcntl.h>
@@ -42,13 +44,37 @@
 #include <syslog.h>
 #include <pwd.h>
 #include <ctype.h>
+#include <glob.h>
+#include <fnmatch.h>
+#include <limits.h>
+#include <sched.h>
+#include <spawn.h>
+#include <sys/wait.h>
+
+extern char **environ;
 
 /* Input subsystem interface */
 #include <linux/input.h>
+#include <linux/hidraw.h>
 
 #include "debug.h"
 #include "hashmap.h"
 #include "mapping.h"
+#include "trace.h"
+#include "capture.h"
+#include "fanout.h"
+#include "hotplug.h"
+#include "uinput.h"
+#include "log.h"
+#include "action.h"
+#include "command.h"
+#include "uring.h"
+#include "dedup.h"
+#include "storm.h"
+#include "evinput.h"
+#include "handover.h"
+#include "rule.h"
+#include "realtime.h"
 
 #define IRMP_FLAG_NEW            0x00
 #define IRMP_FLAG_REPETITION     0x01
@@ -56,6 +82,17 @@
 
 #define REPORT_ID_IR             0x01
 
+#define CLIENT_POOL_CHUNK        32
+
+/* First descriptor passed by socket activation, see sd_listen_fds(3) */
+#define LISTEN_FDS_START         3
+
+#define SOCKETS_MAX              (64)	/* bits of evdev_t.sockets */
+#define IDLE_MESSAGES            (64)	/* held back for PRIORITY_IDLE clients between waits */
+
+#define RESCAN_MIN_MS            10
+#define RESCAN_MAX_MS            2000
+
 typedef struct __attribute__ ((__packed__)) {
   uint8_t	report_id;	// report id
   uint8_t	protocol;	// protocol, i.e. NEC_PROTOCOL
@@ -64,44 +101,162 @@ typedef struct __attribute__ ((__packed__)) {
   uint8_t	flags;		// flags, e.g. repetition
 } IRMP_DATA;
 
+/* Repeat and release tracking of one receiver, so rooms do not mix up their keys */
+typedef struct {
+	uint16_t repeat;
+	uint8_t protocol;	// of the last report, IRMP if the next one has the same
+	double first_time;
+	double last_time;
+	double send_time;
+	repeat_timing_t timing;
+	bool release_pending;
+	IRMP_DATA release_event;	// the pressed key, its _UP goes where it has a name
+	char release_remote[5];
+	int release_keycode;
+	uint64_t release_sockets;	// where the press went
+} key_state_t;
+
 typedef struct evdev {
+	char *path;
 	char *name;
 	int fd;
+	int index;
+	int layer;		// translation table layer, 0 for the global table
+	uint64_t sockets;	// bit n set if sockets[n] gets its reports
+	storm_bucket_t storm;	// token bucket of the whole receiver
+	bool native;		// an event device, read as struct input_event
+	evinput_state_t input;
+	key_state_t key;
+	uint64_t watch;		// io_uring read
 	struct evdev *next;
 } evdev_t;
 
 static evdev_t *evdevs = NULL;
 
+static char **patterns = NULL;
+static int npatterns = 0;
+
+static bool hotplug = false;
+static int hotplugfd = -1;
+static double rescan_at = 0;
+static int rescan_delay = 0;
+
 typedef struct client {
 	int fd;
-	struct client *next;
+	int socket;		// index of the socket it connected to
+	command_buffer_t command;
+	uint64_t watch;		// io_uring poll
+	unsigned long generation;	// tells queued writes a reused client apart
+	struct client *next;	// free list link
 } client_t;
 
-static client_t *clients = NULL;
+/* Messages waiting for the PRIORITY_IDLE clients */
+typedef struct {
+	int index;		// receiver, for the trace
+	uint64_t sockets;
+	int len;
+	char message[FANOUT_MESSAGE_SIZE];
+} idle_message_t;
+
+static idle_message_t idle_messages[IDLE_MESSAGES];
+static int nidle_messages = 0;
+static int nidle_clients = 0;	// open clients in PRIORITY_IDLE, nothing is queued without one
+
+/* Class of the clients of a user, -p */
+typedef struct {
+	uid_t uid;
+	int priority;
+} user_priority_t;
+
+static user_priority_t *user_priorities = NULL;
+static int nuser_priorities = 0;
+
+/* Dense array of connected clients, the client_t objects come from a pool */
+static client_t **clients = NULL;
+static int nclients = 0;
+static int clients_size = 0;
+static client_t *client_pool = NULL;
+
+static int backlog = 32;
+
+/* LIRC sockets, bit n of a receiver's sockets mask routes its reports to sockets[n] */
+typedef struct {
+	char *path;
+	char **patterns;	// receivers it serves, NULL for all of them
+	int npatterns;
+	int layer;		// layer of its own table, 0 to translate like the receiver
+	int fd;
+} lirc_socket_t;
 
-static int sockfd = -1;
+static lirc_socket_t sockets[SOCKETS_MAX];
+static int nsockets = 0;
+static uint64_t table_sockets = 0;	// mask of the sockets with a table of their own
 
 static bool grab = false;
-static char *device = "/var/run/lirc/lircd";
+static bool use_uinput = false;
+static bool use_uring = false;
 
 static int repeat_delay = 0;
 static int repeat_period = 0;
 
-static uint16_t repeat = 0;
-static uint8_t protocol = 0;
 
 static map_t mymap;
-
-/* returns time since 01.01.1970 */
+static rule_index_t *rules = NULL;	// wildcard and range rules of mymap
+static repeat_profiles_t repeat_profiles;
+
+/* Per device and per socket translation tables over the global one, layer n is layers[n - 1] */
+typedef struct {
+	char *pattern;		// devices it applies to, like the device arguments, NULL for a socket's
+	char *path;		// its translation table
+	uint64_t sockets;	// mask of the sockets it is the table of
+	map_t view;		// the layer merged over the global table
+	rule_index_t *rules;	// its rules before the global ones
+} layer_t;
+
+static layer_t *layers = NULL;
+static int nlayers = 0;
+
+static volatile sig_atomic_t dump_trace = 0;
+static volatile sig_atomic_t reload = 0;
+static volatile sig_atomic_t upgrade = 0;
+static volatile sig_atomic_t stop = 0;
+
+/* Binary and arguments to start on an upgrade */
+static char exe_path[PATH_MAX];
+static char **arguments = NULL;
+
+/* Our end of the handover socket while a new binary starts */
+static int upgradefd = -1;
+static uint64_t upgrade_watch = 0;
+static pid_t upgrade_pid = 0;
+
+/* Clients taken over from the previous process, added once we run */
+static fanout_client_t *adopted_clients = NULL;
+static int nadopted = 0;
+
+static char *translation_path = NULL;
+static char *action_path = NULL;
+
+static char *capture_path = NULL;
+static FILE *capture = NULL;
+
+static FILE *replay = NULL;
+static bool replay_fast = false;
+static capture_record_t replay_record;
+static double replay_offset = 0;
+static evdev_t *replay_evdevs[256];
+
+/* returns monotonic time */
 static double getTime_ms(void) {
-	struct timeval sTime;
-	struct timezone tz;
-	double dTime_ms;
+	struct timespec ts;
 	
-	gettimeofday(&sTime, &tz);
-	dTime_ms=((double) sTime.tv_sec * 1000);
-	dTime_ms+=((double) sTime.tv_usec/1000);
-	return dTime_ms;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (double) ts.tv_sec * 1000 + (double) ts.tv_nsec / 1000000;
+}
+
+/* returns the time of the report being replayed */
+static double getReplayTime_ms(void) {
+	return (double) replay_record.ts_us / 1000;
 }
 
 static void *xalloc(size_t size) {
@@ -114,54 +269,232 @@ static void *xalloc(size_t size) {
 	return buf;
 }
 
-static void add_evdevs(int argc, char *argv[]) {
+/* A fresh receiver has no key down and no repeat timing yet */
+static void init_key_state(evdev_t *evdev) {
+	memset(&evdev->key, 0, sizeof evdev->key);
+	evdev->key.timing.delay = -1;
+	evdev->key.release_keycode = -1;
+}
+
+static evdev_t *find_evdev(const char *path) {
+	evdev_t *evdev;
+
+	for(evdev = evdevs; evdev; evdev = evdev->next)
+		if(!strcmp(evdev->path, path))
+			return evdev;
+
+	return NULL;
+}
+
+/* "usb:VVVV:PPPP" matches hidraw devices, "input:VVVV:PPPP" event devices by vendor and product id */
+static bool match_ids(int fd, const char *pattern) {
+	struct hidraw_devinfo info;
+	unsigned int vendor, product;
+
+	if(sscanf(pattern, "input:%x:%x", &vendor, &product) == 2)
+		return evinput_match_ids(fd, vendor, product);
+
+	if(sscanf(pattern, "usb:%x:%x", &vendor, &product) != 2)
+		return true;
+
+	if(ioctl(fd, HIDIOCGRAWINFO, &info) < 0)
+		return false;
+
+	return (uint16_t) info.vendor == vendor && (uint16_t) info.product == product;
+}
+
+/* The devices an id pattern is matched against, NULL for a path pattern */
+static const char *id_glob(const char *pattern) {
+	if(!strncmp(pattern, "usb:", 4))
+		return "/dev/hidraw*";
+	if(!strncmp(pattern, "input:", 6))
+		return "/dev/input/event*";
+	return NULL;
+}
+
+static bool match_pattern(const char *pattern, const char *path, int fd) {
+	return id_glob(pattern) ? match_ids(fd, pattern) : !fnmatch(pattern, path, FNM_PATHNAME);
+}
+
+/* The first layer whose pattern matches the device, 0 if none does */
+static int find_layer(const char *path, int fd) {
 	int i;
-	evdev_t *newdev;
 
-	for(i = 0; i < argc; i++) {
-		newdev = xalloc(sizeof *newdev);
-		newdev->fd = open(argv[i], O_RDONLY);
-		if(newdev->fd < 0) {
+	for(i = 0; i < nlayers; i++)
+		if(layers[i].pattern && match_pattern(layers[i].pattern, path, fd))
+			return i + 1;
+
+	return 0;
+}
+
+/* Mask of the sockets serving the device, looked up once when it is opened */
+static uint64_t find_sockets(const char *path, int fd) {
+	uint64_t mask = 0;
+	int i, p;
+
+	for(i = 0; i < nsockets; i++) {
+		for(p = 0; p < sockets[i].npatterns && !match_pattern(sockets[i].patterns[p], path, fd); p++)
+			;
+		if(!sockets[i].patterns || p < sockets[i].npatterns)
+			mask |= 1ULL << i;
+	}
+
+	if(!mask)
+		LOG(LOG_WARNING, "No socket serves %s", path);
+	return mask;
+}
+
+static bool open_evdev(const char *path, const char *pattern, bool verbose) {
+	evdev_t *newdev, *evdev;
+	int index = 0;
+
+	newdev = xalloc(sizeof *newdev);
+	newdev->fd = open(path, O_RDONLY | O_NONBLOCK | O_CLOEXEC);
+	if(newdev->fd < 0) {
+		free(newdev);
+		if(verbose)
+			fprintf(stderr, "Could not open %s: %s\n", path, strerror(errno));
+		return false;
+	}
+	newdev->native = evinput_open(newdev->fd, &newdev->input);
+	if(!match_ids(newdev->fd, pattern)) {
+		close(newdev->fd);
+		free(newdev);
+		return true;
+	}
+	if(grab) {
+		if(ioctl(newdev->fd, EVIOCGRAB, 1) < 0) {
+			close(newdev->fd);
 			free(newdev);
-			fprintf(stderr, "Could not open %s: %s\n", argv[i], strerror(errno));
-			continue;
+			if(verbose)
+				fprintf(stderr, "Failed to grab %s: %s\n", path, strerror(errno));
+			return false;
 		}
-		if(grab) {
-			if(ioctl(newdev->fd, EVIOCGRAB, 1) < 0) {
-				close(newdev->fd);
-				free(newdev);
-				fprintf(stderr, "Failed to grab %s: %s\n", argv[i], strerror(errno));
-				continue;
-			}
+	}
+
+	/* Use the lowest free index, a replugged receiver usually gets its old one back */
+	for(evdev = evdevs; evdev; ) {
+		if(evdev->index == index) {
+			index++;
+			evdev = evdevs;
+		} else
+			evdev = evdev->next;
+	}
+
+	newdev->path = strdup(path);
+	newdev->name = basename(newdev->path);
+	newdev->index = index;
+	newdev->layer = find_layer(path, newdev->fd);
+	newdev->sockets = find_sockets(path, newdev->fd);
+	init_key_state(newdev);
+	newdev->next = evdevs;
+	evdevs = newdev;
+
+	LOG(LOG_INFO, "Added %s", path);
+	if(newdev->layer)
+		LOG(LOG_INFO, "%s translates with %s", newdev->name, layers[newdev->layer - 1].path);
+	return true;
+}
+
+static void remove_evdev(evdev_t *evdev) {
+	evdev_t **p;
+
+	LOG(LOG_INFO, "Removed %s", evdev->path);
+
+	for(p = &evdevs; *p; p = &(*p)->next)
+		if(*p == evdev) {
+			*p = evdev->next;
+			break;
+		}
+
+	uring_cancel(evdev->watch);
+	close(evdev->fd);
+	free(evdev->path);
+	free(evdev);
+}
+
+/* A receiver opened by the process we replace */
+static void adopt_evdev(const char *path, int fd, int index) {
+	evdev_t *evdev = xalloc(sizeof *evdev);
+
+	evdev->fd = fd;
+	evdev->native = evinput_open(fd, &evdev->input);
+	evdev->path = strdup(path);
+	evdev->name = basename(evdev->path);
+	evdev->index = index;
+	evdev->layer = find_layer(path, fd);
+	evdev->sockets = find_sockets(path, fd);
+	init_key_state(evdev);
+	evdev->next = evdevs;
+	evdevs = evdev;
+
+	LOG(LOG_INFO, "Took over %s", path);
+}
+
+/*
+ * Open all devices matching the patterns from the command line that are not
+ * open yet. Returns false if a matching device could not be opened, e.g.
+ * because udev has not set its permissions yet.
+ */
+static bool scan_evdevs(bool verbose) {
+	const char *pattern;
+	glob_t matches;
+	bool complete = true;
+	size_t i;
+	int p;
+
+	for(p = 0; p < npatterns; p++) {
+		pattern = patterns[p];
+
+		if(glob(id_glob(pattern) ? id_glob(pattern) : pattern, 0, NULL, &matches)) {
+			if(verbose)
+				fprintf(stderr, "Could not open %s: %s\n", pattern, strerror(ENOENT));
+			continue;
 		}
-		newdev->name = basename(strdup(argv[i]));
-		newdev->next = evdevs;
-		evdevs = newdev;
+
+		for(i = 0; i < matches.gl_pathc; i++)
+			if(!find_evdev(matches.gl_pathv[i]) && !open_evdev(matches.gl_pathv[i], pattern, verbose))
+				complete = false;
+
+		globfree(&matches);
 	}
+
+	return complete;
 }
 	
-static bool add_unixsocket(void) {
+/* Listen on sock, or use fd if socket activation passed one for it */
+static bool add_unixsocket(lirc_socket_t *sock, int fd) {
 	struct sockaddr_un sa = {0};
-	sockfd = socket(AF_UNIX, SOCK_STREAM, 0);
 
-	if(sockfd < 0) {
+	if(fd >= 0) {
+		sock->fd = fd;
+		if(fcntl(fd, F_SETFL, fcntl(fd, F_GETFL) | O_NONBLOCK) < 0 || fcntl(fd, F_SETFD, FD_CLOEXEC) < 0) {
+			fprintf(stderr, "Unable to use the activated socket: %s\n", strerror(errno));
+			return false;
+		}
+		return true;
+	}
+
+	sock->fd = socket(AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+
+	if(sock->fd < 0) {
 		fprintf(stderr, "Unable to create an AF_UNIX socket: %s\n", strerror(errno));
 		return false;
 	}
 
 	sa.sun_family = AF_UNIX;
-	strncpy(sa.sun_path, device, sizeof sa.sun_path - 1);
+	strncpy(sa.sun_path, sock->path, sizeof sa.sun_path - 1);
 
-	unlink(device);
+	unlink(sock->path);
 
-	if(bind(sockfd, (struct sockaddr *)&sa, sizeof sa) < 0) {
-		fprintf(stderr, "Unable to bind AF_UNIX socket to %s: %s\n", device, strerror(errno));
+	if(bind(sock->fd, (struct sockaddr *)&sa, sizeof sa) < 0) {
+		fprintf(stderr, "Unable to bind AF_UNIX socket to %s: %s\n", sock->path, strerror(errno));
 		return false;
 	}
 
-	chmod(device, 0666);
+	chmod(sock->path, 0666);
 
-	if(listen(sockfd, 3) < 0) {
+	if(listen(sock->fd, backlog) < 0) {
 		fprintf(stderr, "Unable to listen on AF_UNIX socket: %s\n", strerror(errno));
 		return false;
 	}
@@ -169,188 +502,1285 @@ static bool add_unixsocket(void) {
 	return true;
 }
 
+static bool add_unixsockets(void) {
+	const char *listen_pid = getenv("LISTEN_PID");
+	const char *listen_fds = getenv("LISTEN_FDS");
+	int activated = 0;
+	int i;
+
+	/* Socket activation, the service manager already listens for us, in -d order */
+	if(listen_pid && listen_fds && atoi(listen_pid) == getpid()) {
+		activated = atoi(listen_fds);
+		unsetenv("LISTEN_PID");
+		unsetenv("LISTEN_FDS");
+		unsetenv("LISTEN_FDNAMES");
+	}
+
+	for(i = 0; i < nsockets; i++)
+		if(!add_unixsocket(&sockets[i], i < activated ? LISTEN_FDS_START + i : -1))
+			return false;
 
-static void processnewclient(void) {
-	client_t *newclient = xalloc(sizeof *newclient);
+	return true;
+}
 
-	newclient->fd = accept(sockfd, NULL, NULL);
+static void close_unixsockets(void) {
+	int i;
 
-	if(newclient->fd < 0) {
-		free(newclient);
-		if(errno == ECONNABORTED || errno == EINTR)
-			return;
-		syslog(LOG_ERR, "Error during accept(): %s\n", strerror(errno));
+	for(i = 0; i < nsockets; i++)
+		if(sockets[i].fd >= 0)
+			close(sockets[i].fd);
+}
+
+/* "<user>=<class>" of -p, the user by name or uid */
+static bool parse_user_priority(const char *spec) {
+	const char *class = strchr(spec, '=');
+	char user[64];
+	struct passwd *pwd;
+	char *end;
+	int priority;
+	uid_t uid;
+
+	if(!class || class - spec >= sizeof user || (priority = command_priority(class + 1)) < 0)
+		return false;
+
+	snprintf(user, sizeof user, "%.*s", (int) (class - spec), spec);
+	if((pwd = getpwnam(user)))
+		uid = pwd->pw_uid;
+	else {
+		uid = strtoul(user, &end, 10);
+		if(!*user || *end)
+			return false;
+	}
+
+	user_priorities = realloc(user_priorities, (nuser_priorities + 1) * sizeof *user_priorities);
+	if(!user_priorities)
+		return false;
+	user_priorities[nuser_priorities].uid = uid;
+	user_priorities[nuser_priorities].priority = priority;
+	nuser_priorities++;
+	return true;
+}
+
+/* Returns the number of the new layer, 0 if there are too many */
+static int add_layer(char *pattern, char *path) {
+	if(nlayers + 1 >= LAYER_COUNT)
+		return 0;
+
+	layers = realloc(layers, (nlayers + 1) * sizeof *layers);
+	if(!layers) {
+		fprintf(stderr, "Could not allocate layers: %s\n", strerror(errno));
 		exit(EX_OSERR);
 	}
+	memset(&layers[nlayers], 0, sizeof *layers);
+	layers[nlayers].pattern = pattern;
+	layers[nlayers].path = path;
+	return ++nlayers;
+}
 
-    int flags = fcntl(newclient->fd, F_GETFL);
-    fcntl(newclient->fd, F_SETFL, flags | O_NONBLOCK);
+/* "<path>[=<pattern>,...][@<table>]" of -d */
+static bool parse_socket(const char *spec) {
+	lirc_socket_t *sock = &sockets[nsockets];
+	const char *patterns = strchr(spec, '=');
+	const char *table = strrchr(spec, '@');
+	char *copy, *pattern, *save;
+	int i;
+
+	if(nsockets == SOCKETS_MAX)
+		return false;
 
-	newclient->next = clients;
-	clients = newclient;
+	/* A table of its own is a layer no receiver matches */
+	if(table && patterns && table < patterns)
+		patterns = NULL;
+
+	memset(sock, 0, sizeof *sock);
+	sock->fd = -1;
+	sock->path = strndup(spec, patterns ? patterns - spec : table ? table - spec : strlen(spec));
+
+	/* Sockets sharing a table share its layer, a report is translated once for all of them */
+	if(table) {
+		for(i = 0; i < nlayers && (layers[i].pattern || strcmp(layers[i].path, table + 1)); i++)
+			;
+		sock->layer = i < nlayers ? i + 1 : add_layer(NULL, strdup(table + 1));
+		if(!table[1] || !sock->layer)
+			return false;
+		layers[sock->layer - 1].sockets |= 1ULL << nsockets;
+		table_sockets |= 1ULL << nsockets;
+	}
+
+	if(patterns) {
+		copy = table ? strndup(patterns + 1, table - patterns - 1) : strdup(patterns + 1);
+		for(pattern = strtok_r(copy, ",", &save); pattern; pattern = strtok_r(NULL, ",", &save)) {
+			sock->patterns = realloc(sock->patterns, (sock->npatterns + 1) * sizeof *sock->patterns);
+			if(!sock->patterns)
+				return false;
+			sock->patterns[sock->npatterns++] = pattern;
+		}
+		if(!sock->npatterns)
+			return false;
+	}
+
+	nsockets++;
+	return true;
 }
 
-static void processevent(evdev_t *evdev) {
-	IRMP_DATA event;
+
+static client_t *alloc_client(void) {
+	client_t *client;
+	unsigned long generation;
+	int i;
+
+	if(!client_pool) {
+		client_pool = xalloc(CLIENT_POOL_CHUNK * sizeof *client_pool);
+		for(i = 0; i < CLIENT_POOL_CHUNK - 1; i++)
+			client_pool[i].next = &client_pool[i + 1];
+	}
+
+	client = client_pool;
+	client_pool = client->next;
+	generation = client->generation;
+	memset(client, 0, sizeof *client);
+	client->generation = generation + 1;
+	return client;
+}
+
+static void free_client(client_t *client) {
+	client->next = client_pool;
+	client_pool = client;
+}
+
+/* Drop clients whose fd was closed, keeping the order of the others */
+static void reap_clients(void) {
+	int i, n;
+
+	for(i = n = 0; i < nclients; i++) {
+		if(clients[i]->fd < 0)
+			free_client(clients[i]);
+		else
+			clients[n++] = clients[i];
+	}
+	nclients = n;
+}
+
+static void close_client(client_t *client) {
+	if(client->fd >= 0 && client->command.priority == PRIORITY_IDLE)
+		nidle_clients--;
+	uring_cancel(client->watch);
+	close(client->fd);
+	client->fd = -1;
+}
+
+static void processclient(client_t *client) {
+	int priority = client->command.priority;
+	bool alive = command_process(client->fd, &client->command);
+
+	/* PRIORITY may have moved it in or out of the idle class */
+	nidle_clients += (client->command.priority == PRIORITY_IDLE) - (priority == PRIORITY_IDLE);
+	if(!alive)
+		close_client(client);
+}
+
+static void client_ready(void *arg, unsigned long tag, int res, const void *data) {
+	client_t *client = arg;
+
+	if(res < 0)
+		close_client(client);
+	else
+		processclient(client);
+	reap_clients();
+}
+
+static void add_client(int fd, int socket, int priority) {
+	client_t *client = alloc_client();
+
+	if(nclients == clients_size) {
+		clients_size = clients_size ? 2 * clients_size : CLIENT_POOL_CHUNK;
+		clients = realloc(clients, clients_size * sizeof *clients);
+		if(!clients) {
+			fprintf(stderr, "Could not allocate client array: %s\n", strerror(errno));
+			exit(EX_OSERR);
+		}
+	}
+
+	client->fd = fd;
+	client->socket = socket;
+	client->command.priority = priority;
+	if(uring_active() && !(client->watch = uring_poll(fd, client_ready, client))) {
+		LOG(LOG_ERR, "Unable to watch client %d", fd);
+		close(fd);
+		free_client(client);
+		return;
+	}
+	clients[nclients++] = client;
+	if(priority == PRIORITY_IDLE)
+		nidle_clients++;
+}
+
+/* The class -p gives the user at the other end, PRIORITY_NORMAL if none */
+static int peer_priority(int fd) {
+	struct ucred cred;
+	socklen_t len = sizeof cred;
+	int i;
+
+	if(getsockopt(fd, SOL_SOCKET, SO_PEERCRED, &cred, &len) < 0)
+		return PRIORITY_NORMAL;
+
+	for(i = 0; i < nuser_priorities; i++)
+		if(user_priorities[i].uid == cred.uid)
+			return user_priorities[i].priority;
+
+	return PRIORITY_NORMAL;
+}
+
+/* Accept every pending connection, clients tend to reconnect all at once */
+static void processnewclient(int socket) {
+	int fd;
+
+	while(true) {
+		fd = accept4(sockets[socket].fd, NULL, NULL, SOCK_NONBLOCK | SOCK_CLOEXEC);
+
+		if(fd < 0) {
+			if(errno == EAGAIN || errno == EWOULDBLOCK)
+				return;
+			if(errno == ECONNABORTED || errno == EINTR)
+				continue;
+			syslog(LOG_ERR, "Error during accept(): %s\n", strerror(errno));
+			exit(EX_OSERR);
+		}
+
+		if(fanout_active())
+			fanout_add_client(fd, socket, peer_priority(fd));
+		else
+			add_client(fd, socket, peer_priority(fd));
+	}
+}
+
+static bool have_clients(void) {
+	return nclients > 0 || fanout_clients() > 0;
+}
+
+/* A queued write is tagged with the client generation and the receiver for the trace */
+#define WRITE_TAG(generation, index)  ((generation) << 16 | (uint16_t) (index))
+
+static void written(void *arg, unsigned long tag, int res, const void *data) {
+	client_t *client = arg;
+
+	/* Closed meanwhile, maybe even handed to a new connection */
+	if(client->fd < 0 || WRITE_TAG(client->generation, 0) >> 16 != tag >> 16)
+		return;
+
+	/* The send completed only now, whether it went out or failed */
+	TRACE(TRACE_WRITE, (int) (tag & 0xffff), client->fd);
+
+	if(res >= 0) {
+		LOG(LOG_DEBUG, "written message to %d", client->fd);
+		return;
+	}
+
+	close_client(client);
+	reap_clients();
+}
+
+/* Queue the message for every client, they go out with the next wait */
+static void uring_broadcast(int index, uint64_t sockets, const char *message, int len, int first, int last) {
+	uring_message_t *shared = uring_message(message, len);
+	client_t *client;
+	int i, priority;
+
+	if(!shared) {
+		LOG(LOG_ERR, "Unable to allocate message");
+		return;
+	}
+
+	for(priority = first; priority <= last; priority++)
+		for(i = 0; i < nclients; i++) {
+			client = clients[i];
+			if(client->command.priority != priority || !(sockets & 1ULL << client->socket))
+				continue;
+			if(!uring_send(client->fd, shared, written, client, WRITE_TAG(client->generation, index)))
+				LOG(LOG_ERR, "Unable to queue message for %d", client->fd);
+		}
+
+	uring_release(shared);
+}
+
+/* Write the message to the clients of the classes first to last, in that order */
+static void send_clients(int index, uint64_t sockets, const char *message, int len, int first, int last) {
+	client_t *client;
+	bool dead = false;
+	int i, priority;
+
+	if(uring_active()) {
+		uring_broadcast(index, sockets, message, len, first, last);
+		return;
+	}
+
+	for(priority = first; priority <= last; priority++)
+		for(i = 0; i < nclients; i++) {
+			client = clients[i];
+			if(client->command.priority != priority || !(sockets & 1ULL << client->socket))
+				continue;
+			if(write(client->fd, message, len) != len) {
+				close_client(client);
+				dead = true;
+			} else
+				LOG(LOG_DEBUG, "written message to %d", client->fd);
+			TRACE(TRACE_WRITE, index, client->fd);
+		}
+
+	if(dead)
+		reap_clients();
+}
+
+/* The PRIORITY_IDLE clients get what they missed once the loop is about to wait */
+static void flush_idle(void) {
+	idle_message_t *idle;
+
+	/* The last idle client may have gone since the messages were queued */
+	if(!nidle_clients)
+		nidle_messages = 0;
+
+	for(idle = idle_messages; idle < idle_messages + nidle_messages; idle++)
+		send_clients(idle->index, idle->sockets, idle->message, idle->len, PRIORITY_IDLE, PRIORITY_IDLE);
+	nidle_messages = 0;
+}
+
+/* Send the message to the clients of the sockets set in sockets, index is the receiver for the trace */
+static void broadcast(int index, uint64_t sockets, const char *message, int len) {
+	idle_message_t *idle;
+
+	if(fanout_active()) {
+		fanout_publish(message, len, sockets);
+		return;
+	}
+
+	send_clients(index, sockets, message, len, PRIORITY_HIGH, PRIORITY_NORMAL);
+	if(!nidle_clients)
+		return;
+
+	if(nidle_messages == IDLE_MESSAGES)
+		flush_idle();
+	idle = &idle_messages[nidle_messages++];
+	idle->index = index;
+	idle->sockets = sockets;
+	idle->len = len < sizeof idle->message ? len : sizeof idle->message;
+	memcpy(idle->message, message, idle->len);
+}
+
+/* Exact codes first, the rules only if there is none */
+static map_entry_t *translate(int index, const IRMP_DATA *event) {
+	const layer_t *layer = index ? &layers[index - 1] : NULL;
+	map_entry_t *map_entry;
+
+	if(hashmap_get_u64(layer ? layer->view : mymap, IRMP_KEY(event->protocol, event->address, event->command), (void **) &map_entry) == MAP_OK)
+		return map_entry;
+
+	return rule_lookup(layer ? layer->rules : rules, event->protocol, event->address, event->command);
+}
+
+/* The message for the entry the code translated to, a code without one goes out as is unless unnamed is false */
+static void send_view(const evdev_t *evdev, const map_entry_t *map_entry, uint64_t mask, const char *irmp_fulldata, int repeat,
+		      const char *suffix, const char *remote_name, bool unnamed) {
+	char message[59];
+	int len;
+
+	if (map_entry)
+		len = snprintf(message, sizeof message, "%s %x %s%s %s\n",  irmp_fulldata, repeat, map_entry->value, suffix, remote_name); // 12+1+4+1+31+3+1+4+1+1=59
+	else if (unnamed)
+		len = snprintf(message, sizeof message, "%s %x %s %s\n",  irmp_fulldata, repeat, irmp_fulldata, remote_name);
+	else
+		return;
+
+	TRACE(TRACE_FORMAT, evdev->index, len);
+	LOG(LOG_DEBUG, "LIRC message=%s", message);
+	broadcast(evdev->index, mask, message, len);
+}
+
+/*
+ * The sockets that follow the receiver's layer get map_entry, the others
+ * the code translated once per table among them
+ */
+static void send_views(const evdev_t *evdev, const map_entry_t *map_entry, uint64_t mask, const IRMP_DATA *event, int repeat,
+		       const char *suffix, const char *remote_name, bool unnamed) {
+	uint64_t rest = mask & table_sockets;
 	char irmp_fulldata[13];
-	char message[58];
-	static char release_pending_message[58];
-	int len, release_pending_len = 0;
-	static double first_time = 0;
-	static double last_time = 0;
-	static double send_time = 0;
-	client_t *client, *prev, *next;
-	static bool release_pending = false;
-	char remote_name[5];
+	const layer_t *layer;
+	int i;
 
-	if((len=read(evdev->fd, &event, sizeof event)) <= 0) {
-		syslog(LOG_ERR, "Error processing event from %s: %s\n", evdev->name, strerror(errno));
-		exit(EX_OSERR);
+	snprintf (irmp_fulldata, sizeof irmp_fulldata, "%02x%04x%04x%02x", event->protocol, event->address, event->command, 0); // 2+4+4+2+1=13
+
+	if (mask & ~table_sockets)
+		send_view(evdev, map_entry, mask & ~table_sockets, irmp_fulldata, repeat, suffix, remote_name, unnamed);
+
+	for (i = 0; rest && i < nsockets; i++) {
+		if (!(rest & 1ULL << i))
+			continue;
+		layer = &layers[sockets[i].layer - 1];
+		send_view(evdev, translate(sockets[i].layer, event), rest & layer->sockets, irmp_fulldata, repeat, suffix, remote_name, unnamed);
+		rest &= ~layer->sockets;
 	}
+}
+
+/* now is when the receiver got the report */
+/* Release the key the receiver still holds down, to the clients the press went to */
+static void release_key(evdev_t *evdev) {
+	key_state_t *key = &evdev->key;
+
+	if (!key->release_pending)
+		return;
+
+	LOG(LOG_DEBUG, "pending release!");
+	send_views(evdev, translate(evdev->layer, &key->release_event), key->release_sockets, &key->release_event, 0, "_UP", key->release_remote, false);
+	if (key->release_keycode >= 0)
+		uinput_key(key->release_keycode, UINPUT_RELEASE);
+	key->release_pending = false;
+}
+
+static void processreport(evdev_t *evdev, IRMP_DATA event, double now) {
+	key_state_t *key = &evdev->key;
+	char irmp_fulldata[13];
+	char remote_name[5];
 
 	if (event.report_id == REPORT_ID_IR)
-		DBG ("report_id = 0x%02d, p = %02d, a = 0x%04x, c = 0x%04x, f = 0x%02x\n", event.report_id, event.protocol, event.address, event.command, event.flags);
+		LOG(LOG_DEBUG, "report_id = 0x%02d, p = %02d, a = 0x%04x, c = 0x%04x, f = 0x%02x", event.report_id, event.protocol, event.address, event.command, event.flags);
 	else
 		return;
 
+	TRACE(TRACE_READ, evdev->index, event.flags);
+
+	/* A stuck button or IR noise, before it costs a lookup and a write to every client */
+	if(storm_active() && event.flags != IRMP_FLAG_RELEASE && storm_drop(&evdev->storm, IRMP_KEY(event.protocol, event.address, event.command), evdev->index, now)) {
+		TRACE(TRACE_FILTER, evdev->index, 0);
+		return;
+	}
+
+	/* Another receiver in the room caught the same frame */
+	if(dedup_active() && dedup_duplicate(IRMP_KEY(event.protocol, event.address, event.command) | event.flags, evdev->index, now)) {
+		LOG(LOG_DEBUG, "duplicate from %s", evdev->name);
+		TRACE(TRACE_FILTER, evdev->index, 0);
+		return;
+	}
+
 	if(event.flags == IRMP_FLAG_NEW) {
-		//DBG("delta %.2f\n", getTime_ms() - first_time);
-		first_time = getTime_ms();
-		repeat = 0;
-		if (release_pending) {
-			DBG ("LIRC message=%s, pending release!\n", release_pending_message);
-			for(client = clients; client; client = client->next) {
-				if(write(client->fd, release_pending_message, release_pending_len) != release_pending_len) {
-					close(client->fd);
-					client->fd = -1;
-				} else
-					DBG ("written release_pending_message\n");
-			}
-		}
-		release_pending = true;
+		//DBG("delta %.2f\n", now - key->first_time);
+		release_key(evdev);
+		key->first_time = now;
+		key->repeat = 0;
+		key->timing = *repeat_profile(&repeat_profiles, event.protocol, event.address);
+		key->release_pending = true;
 	}
 
 	if(event.flags == IRMP_FLAG_REPETITION) {
-		if(((getTime_ms() - first_time) < repeat_delay) || (getTime_ms() - last_time) < repeat_period) {
+		if(key->timing.delay < 0)
+			key->timing = *repeat_profile(&repeat_profiles, event.protocol, event.address);
+		if(((now - key->first_time) < key->timing.delay) || (now - key->last_time) < key->timing.period) {
+			TRACE(TRACE_FILTER, evdev->index, 0);
 			return;
 		} else {
-			last_time=getTime_ms();
-			repeat++;
+			key->last_time=now;
+			key->repeat++;
 		}
 	}
 
+	TRACE(TRACE_FILTER, evdev->index, 1);
+
 	if (event.flags == IRMP_FLAG_RELEASE)
-		release_pending = false;
+		key->release_pending = false;
 
 	snprintf (irmp_fulldata, sizeof irmp_fulldata, "%02x%04x%04x%02x", event.protocol, event.address, event.command, 0); // 2+4+4+2+1=13
 
 	map_entry_t *map_entry;
 	
-	snprintf(remote_name, sizeof(remote_name), "%s", event.protocol == protocol ? "IRMP" : "NEWP");
-	protocol = event.protocol;
-
-	if(hashmap_get(mymap, irmp_fulldata, (void**)(&map_entry))==MAP_OK) {
-		DBG ("MAP_OK irmp_fulldata=%s lirc=%s\n", irmp_fulldata, map_entry->value);
-		len = snprintf(message, sizeof message, "%s %x %s%s %s",  irmp_fulldata, repeat, map_entry->value, event.flags == IRMP_FLAG_RELEASE ? "_UP" : "", remote_name); // 12+1+4+1+31+3+1+4+1=58
-		if (event.flags == IRMP_FLAG_NEW) {
-			release_pending_len = snprintf(release_pending_message, sizeof release_pending_message, "%s %x %s%s %s",  irmp_fulldata, repeat, map_entry->value, "_UP", remote_name);
-			//DBG ("release_pending_message: %s\n", release_pending_message);
-		}
+	snprintf(remote_name, sizeof(remote_name), "%s", event.protocol == key->protocol ? "IRMP" : "NEWP");
+	key->protocol = event.protocol;
+
+	if((map_entry = translate(evdev->layer, &event))) {
+		TRACE(TRACE_LOOKUP, evdev->index, 1);
+		LOG(LOG_DEBUG, "MAP_OK irmp_fulldata=%s lirc=%s", irmp_fulldata, map_entry->value);
+		if (event.flags == IRMP_FLAG_NEW)
+			key->release_keycode = map_entry->keycode;
+		if (action_active())
+			action_feed(map_entry, key->repeat, event.flags == IRMP_FLAG_RELEASE, now);
+		if (use_uinput)
+			uinput_key(map_entry->keycode, event.flags == IRMP_FLAG_NEW ? UINPUT_PRESS : event.flags == IRMP_FLAG_REPETITION ? UINPUT_REPEAT : UINPUT_RELEASE);
 	} else {
-		DBG ("MAP_ERROR irmp_fulldata=%s\n", irmp_fulldata);
-		len = snprintf(message, sizeof message, "%s %x %s %s",  irmp_fulldata, repeat, irmp_fulldata, remote_name);
+		TRACE(TRACE_LOOKUP, evdev->index, 0);
+		LOG(LOG_DEBUG, "MAP_ERROR irmp_fulldata=%s", irmp_fulldata);
+		if (event.flags == IRMP_FLAG_NEW)
+			key->release_keycode = -1;
+		if (action_active() && event.flags != IRMP_FLAG_RELEASE)
+			action_feed_name(irmp_fulldata, key->repeat, now);
 	}
 
-	DBG ("LIRC message=%s %s, since last sent: %.2f\n\n", message, release_pending ? "release pending" : "release not pending", getTime_ms() - send_time);
-	send_time = getTime_ms();
+	/* A socket with a table of its own may name a code the receiver's table does not */
+	if (event.flags == IRMP_FLAG_NEW) {
+		key->release_event = event;
+		memcpy(key->release_remote, remote_name, sizeof key->release_remote);
+		key->release_sockets = evdev->sockets;
+	}
 
-	for(client = clients; client; client = client->next) {
-		if(write(client->fd, message, len) != len) {
-			close(client->fd);
-			client->fd = -1;
-		} else
-			DBG ("written message\n\n");
+	LOG(LOG_DEBUG, "%s, since last sent: %.2f", key->release_pending ? "release pending" : "release not pending", now - key->send_time);
+	key->send_time = now;
+
+	send_views(evdev, map_entry, evdev->sockets, &event, key->repeat, event.flags == IRMP_FLAG_RELEASE ? "_UP" : "", remote_name, true);
+}
+
+static void lost_evdev(evdev_t *evdev, const char *reason) {
+	LOG(LOG_ERR, "Error processing event from %s: %s", evdev->name, reason);
+	/* Unplugged with a key down, it would stay pressed */
+	release_key(evdev);
+	remove_evdev(evdev);
+	if(!evdevs && !hotplug && !replay) {
+		log_flush();
+		exit(EX_OSERR);
 	}
+	/* A re-enumerated receiver may already be back under the same name */
+	if(hotplug)
+		rescan_at = getTime_ms();
+}
 
-	for(prev = NULL, client = clients; client; client = next) {
-		next = client->next;
-		if(client->fd < 0) {
-			if(prev)
-				prev->next = client->next;
-			else
-				clients = client->next;
-			free(client);
-		} else {
-			prev = client;
-		}
+static void received(evdev_t *evdev, IRMP_DATA event, double now) {
+	if(capture)
+		capture_write(capture, now * 1000, evdev->index, evdev->layer, evdev->sockets, &event);
+
+	processreport(evdev, event, now);
+}
+
+/* A batch of input events from a native event device, len bytes of them */
+static void received_input(evdev_t *evdev, const struct input_event *events, int len) {
+	static const uint8_t flags[] = { IRMP_FLAG_RELEASE, IRMP_FLAG_NEW, IRMP_FLAG_REPETITION };
+	evinput_report_t reports[EVINPUT_BATCH];
+	IRMP_DATA event = { .report_id = REPORT_ID_IR };
+	int i, n;
+
+	n = evinput_decode(&evdev->input, events, len / sizeof *events, reports, getTime_ms());
+	for(i = 0; i < n; i++) {
+		event.protocol = reports[i].protocol;
+		event.address = reports[i].address;
+		event.command = reports[i].command;
+		event.flags = flags[reports[i].value];
+		received(evdev, event, reports[i].time);
+	}
+}
+
+static void processevent(evdev_t *evdev) {
+	struct input_event events[EVINPUT_BATCH];
+	IRMP_DATA event;
+	int len;
+
+	if(evdev->native)
+		len = read(evdev->fd, events, sizeof events);
+	else
+		len = read(evdev->fd, &event, sizeof event);
+
+	if(len <= 0) {
+		if(len < 0 && (errno == EINTR || errno == EAGAIN))
+			return;
+		lost_evdev(evdev, len < 0 ? strerror(errno) : "device closed");
+		return;
+	}
+
+	if(evdev->native)
+		received_input(evdev, events, len);
+	else
+		received(evdev, event, getTime_ms());
+}
+
+/* io_uring callback, every read is one report like with read() */
+static void evdev_read(void *arg, unsigned long tag, int res, const void *data) {
+	evdev_t *evdev = arg;
+	IRMP_DATA event;
+
+	if(res <= 0) {
+		lost_evdev(evdev, res < 0 ? strerror(-res) : "device closed");
+		return;
+	}
+
+	if(evdev->native) {
+		received_input(evdev, data, res);
+		return;
+	}
+
+	memset(&event, 0, sizeof event);
+	memcpy(&event, data, res < sizeof event ? res : sizeof event);
+	received(evdev, event, getTime_ms());
+}
+
+/* Start reading devices that were opened since the last call */
+static void watch_evdevs(void) {
+	evdev_t *evdev;
+
+	for(evdev = evdevs; evdev; evdev = evdev->next)
+		if(!evdev->watch && !(evdev->watch = uring_read(evdev->fd, evdev_read, evdev)))
+			LOG(LOG_ERR, "Unable to read %s through io_uring", evdev->name);
+}
+
+static evdev_t *replay_evdev(int index) {
+	evdev_t *evdev;
+	char name[16];
+
+	if(!replay_evdevs[index]) {
+		evdev = xalloc(sizeof *evdev);
+		snprintf(name, sizeof name, "replay%d", index);
+		evdev->name = strdup(name);
+		evdev->fd = -1;
+		evdev->index = index;
+		evdev->sockets = ~0ULL;
+		init_key_state(evdev);
+		replay_evdevs[index] = evdev;
+	}
+
+	return replay_evdevs[index];
+}
+
+static bool start_replay(const char *path) {
+	replay = capture_open(path);
+	if(!replay)
+		return false;
+
+	if(!capture_read(replay, &replay_record)) {
+		fprintf(stderr, "Capture file %s is empty\n", path);
+		fclose(replay);
+		replay = NULL;
+		return false;
+	}
+
+	return true;
+}
+
+/* Returns the time in ms until the next report is due */
+static int processreplay(void) {
+	static int reports = 0;
+	static double start;
+	IRMP_DATA event;
+	evdev_t *evdev;
+	double due;
+
+	if(!reports) {
+		start = getTime_ms();
+		replay_offset = start - getReplayTime_ms();
 	}
+
+	do {
+		due = getReplayTime_ms() + replay_offset;
+		if(!replay_fast && due > getTime_ms())
+			return due - getTime_ms() + 1;
+
+		/* Delivered like during the capture, if the -L and -d options are the same */
+		evdev = replay_evdev(replay_record.device);
+		evdev->layer = replay_record.layer <= nlayers ? replay_record.layer : 0;
+		evdev->sockets = replay_record.sockets;
+
+		memcpy(&event, replay_record.report, sizeof event);
+		processreport(evdev, event, getReplayTime_ms());
+		reports++;
+	} while(capture_read(replay, &replay_record));
+
+	LOG(LOG_INFO, "Replay finished, %d reports in %.2f ms", reports, getTime_ms() - start);
+	fclose(replay);
+	replay = NULL;
+	return -1;
 }
 
 static void print_help() {
 
-	printf("irmplircd [-d socket] [-f] [-c] [-r repeat-delay] [-s repeat-period] [-m keycode] -u username] device [device ...]\n\n");
+	printf("irmplircd [-d socket[=pattern,...][@table]] [-f] [-c] [-r repeat-delay] [-s repeat-period] [-m keycode] -u username] [-t table] [-L pattern=table] [-T trace] [-R capture] [-P capture [-a]] [-w workers] [-H] [-b backlog] [-U] [-l level] [-e actions] [-B backend] [-D window] [-Q rate] [-p user=class] [-S priority] [-C cpu] device [device ...]\n\n");
 	printf("Options: \n");
-	printf("\t-d <socket> UNIX socket. The default is /var/run/lirc/lircd.\n");
+	printf("\t-d <socket>[=pattern,...][@table] UNIX socket, only for the receivers matching\n");
+	printf("\t   a pattern if any are given. Repeat for more sockets. A socket translates\n");
+	printf("\t   with its own table over the global one if given, otherwise like the\n");
+	printf("\t   receiver, see -L. The default is /var/run/lirc/lircd.\n");
 	printf("\t-f Run in the foreground.\n");
 	printf("\t-r <delay> Repeat delay in ms (delay for first repeat\n");
 	printf("\t-s <period> Repeat period in ms (delay for further repeats\n");
+	printf("\t   Both can be overridden per protocol and remote address in the translation table.\n");
 	printf("\t-g Grab the input device(s).\n");
 	printf("\t-u <user> User name.\n");
 	printf("\t-t <path> Path to translation table.\n");
-	printf("\tdevice The input device e.g. /dev/hidraw0\n");
+	printf("\t-L <pattern>=<path> Translate devices matching <pattern> with the table <path>,\n");
+	printf("\t   codes it lacks come from the -t table. The first matching -L wins.\n");
+	printf("\t-T <path> Trace events, SIGUSR1 writes the trace to <path>.\n");
+	printf("\t-R <path> Record all reports to a capture file.\n");
+	printf("\t-P <path> Replay a capture file once the first client connected. Reports go\n");
+	printf("\t   to the layers and sockets they had, given the same -L and -d options.\n");
+	printf("\t-a Replay as fast as possible instead of in real time.\n");
+	printf("\t-w <n> Write to clients from <n> worker threads.\n");
+	printf("\t-H Add and remove devices while running.\n");
+	printf("\t-b <n> Listen backlog of the UNIX socket, default 32.\n");
+	printf("\t-l <level> Syslog level of messages to log, 7 includes debug messages.\n");
+	printf("\t-e <path> Run the commands of an irmpexec style action table directly.\n");
+	printf("\t-U Inject mapped KEY_ names as input events through a uinput device.\n");
+	printf("\t-D <ms> Drop reports another receiver already delivered within <ms>, e.g. 50.\n");
+	printf("\t-Q <rate>[,burst[,device rate[,device burst]]] Limit each code to <rate> frames\n");
+	printf("\t   per second, each receiver to 4 times that. A code over its limit for 3 s is\n");
+	printf("\t   dropped until it pauses for 1 s. SIGUSR1 logs the drops.\n");
+	printf("\t-p <user>=<class> Put clients of <user> in class high, normal or idle. High\n");
+	printf("\t   ones get every key first, idle ones once nothing else is pending. Clients\n");
+	printf("\t   may also send PRIORITY <class>. All are normal by default.\n");
+	printf("\t-B <backend> poll (default) or uring to read and write through io_uring,\n");
+	printf("\t   falls back to poll if the kernel lacks it (multishot reads need Linux 6.7).\n");
+	printf("\t-S <priority> Real-time mode: lock all memory and run the event loop with\n");
+	printf("\t   SCHED_FIFO <priority>, 0 only locks memory. SIGUSR1 logs its page faults.\n");
+	printf("\t-C <cpu> Real-time mode with the event loop pinned to <cpu>.\n");
+	printf("\tdevice The input device e.g. /dev/hidraw0, a pattern like /dev/hidraw*\n");
+	printf("\t       or usb:<vendor>:<product> to match hidraw devices by id. Event devices\n");
+	printf("\t       like /dev/input/event3, or input:<vendor>:<product> to match them by id,\n");
+	printf("\t       report scancodes as protocol fe, key codes without one as protocol ff,\n");
+	printf("\t       e.g. fe0000001600 or ff0000007400 in the table.\n");
+	printf("\nSIGHUP reloads the tables, SIGUSR2 hands all sockets and devices over to a\n");
+	printf("freshly started copy of the binary, e.g. after an update, without dropping clients.\n");
 	
 }
 
-static void main_loop(void) {
-	fd_set permset;
-	fd_set fdset;
+static void sigusr1_handler(int sig) {
+	dump_trace = 1;
+}
+
+static void sigterm_handler(int sig) {
+	stop = 1;
+}
+
+static void sighup_handler(int sig) {
+	reload = 1;
+}
+
+static void sigusr2_handler(int sig) {
+	upgrade = 1;
+}
+
+static bool parse_layers(map_t map) {
+	int i;
+
+	for(i = 0; i < nlayers; i++)
+		if(!parse_layer_table(layers[i].path, map, i + 1))
+			return false;
+
+	return true;
+}
+
+static void free_views(void) {
+	int i;
+
+	for(i = 0; i < nlayers; i++) {
+		if(layers[i].view)
+			hashmap_free(layers[i].view);
+		rule_index_free(layers[i].rules);
+		layers[i].view = NULL;
+		layers[i].rules = NULL;
+	}
+	rule_index_free(rules);
+	rules = NULL;
+}
+
+/*
+ * Merge every layer over the global table in map and index the rules of
+ * all of them, the old views stay on failure
+ */
+static bool build_views(map_t map) {
+	map_t views[nlayers + 1];
+	rule_index_t *indexes[nlayers + 1];
+	int i;
+
+	for(i = 0; i <= nlayers; i++) {
+		views[i] = i ? translation_view(map, i) : NULL;
+		indexes[i] = rule_index_new(map, i);
+		if((i && !views[i]) || !indexes[i]) {
+			fprintf(stderr, "Unable to index translation table layer %d: %s\n", i, strerror(errno));
+			do {
+				if(views[i])
+					hashmap_free(views[i]);
+				rule_index_free(indexes[i]);
+			} while(i--);
+			return false;
+		}
+	}
+
+	free_views();
+	rules = indexes[0];
+	for(i = 1; i <= nlayers; i++) {
+		layers[i - 1].view = views[i];
+		layers[i - 1].rules = indexes[i];
+	}
+	return true;
+}
+
+/* Load the tables again, the running ones stay if a new one is broken */
+static void reload_tables(void) {
+	repeat_profiles_t profiles;
+	map_t map = hashmap_new();
+
+	memset(&profiles, 0, sizeof profiles);
+	repeat_profiles_clear(&profiles);
+
+	if(!map || (translation_path && !parse_translation_table(translation_path, map, &profiles)) || !parse_layers(map) ||
+	   (action_path && !action_open(action_path, map)) || !command_build(map) || !build_views(map)) {
+		LOG(LOG_ERR, "Reload failed, keeping the current tables");
+		repeat_profiles_clear(&profiles);
+		if(map)
+			free_translation_table(map);
+		return;
+	}
+
+	uinput_resolve(map);
+	repeat_profiles_init(&profiles, repeat_delay, repeat_period);
+	repeat_profiles_clear(&repeat_profiles);
+	repeat_profiles = profiles;
+
+	free_translation_table(mymap);
+	mymap = map;
+
+	LOG(LOG_INFO, "Reloaded %d translations", hashmap_length(mymap));
+}
+
+
+static void processhotplug(void) {
+	if(hotplug_process(hotplugfd)) {
+		rescan_delay = 0;
+		rescan_at = getTime_ms();
+	}
+}
+
+static void socket_ready(void *arg, unsigned long tag, int res, const void *data) {
+	lirc_socket_t *sock = arg;
+
+	if(res < 0) {
+		syslog(LOG_ERR, "Error polling the socket %s: %s\n", sock->path, strerror(-res));
+		exit(EX_OSERR);
+	}
+	processnewclient(sock - sockets);
+}
+
+static void hotplug_ready(void *arg, unsigned long tag, int res, const void *data) {
+	if(res < 0) {
+		syslog(LOG_ERR, "Error polling for hotplug events: %s\n", strerror(-res));
+		exit(EX_OSERR);
+	}
+	processhotplug();
+}
+
+/* Move every descriptor we wait for over to io_uring */
+static bool start_uring(void) {
+	int i;
+
+	/* Big enough for a batch of input events, a hidraw read still returns one report */
+	if(!uring_open(URING_ENTRIES, EVINPUT_BATCH * sizeof(struct input_event)))
+		return false;
+
+	for(i = 0; i < nsockets; i++)
+		if(!uring_poll(sockets[i].fd, socket_ready, &sockets[i])) {
+			uring_close();
+			return false;
+		}
+
+	if((hotplugfd >= 0 && !uring_poll(hotplugfd, hotplug_ready, NULL))) {
+		uring_close();
+		return false;
+	}
+
+	watch_evdevs();
+	return true;
+}
+
+/* Returns the time in ms until the next rescan, -1 if none is pending */
+static int processrescan(void) {
+	double now = getTime_ms();
+	bool complete;
+
+	if(!rescan_at)
+		return -1;
+
+	if(rescan_at > now)
+		return rescan_at - now + 1;
+
+	complete = scan_evdevs(false);
+	if(uring_active())
+		watch_evdevs();
+
+	/* udev may still be busy with the permissions, retry a few times */
+	if(!complete && rescan_delay < RESCAN_MAX_MS) {
+		rescan_delay = rescan_delay ? 2 * rescan_delay : RESCAN_MIN_MS;
+		rescan_at = now + rescan_delay;
+		return rescan_delay;
+	}
+
+	rescan_at = 0;
+	return -1;
+}
+
+static void upgrade_ready(void *arg, unsigned long tag, int res, const void *data);
+
+/* Start the new binary, it asks for our descriptors once it is ready */
+static void start_upgrade(void) {
+	int pair[2];
+	char fd[16];
+	int err;
+
+	if(upgradefd >= 0) {
+		LOG(LOG_WARNING, "Upgrade already in progress");
+		return;
+	}
+
+	if(socketpair(AF_UNIX, SOCK_SEQPACKET | SOCK_CLOEXEC, 0, pair) < 0) {
+		LOG(LOG_ERR, "Unable to create handover socket: %s", strerror(errno));
+		return;
+	}
+
+	/* Only the new binary's end survives the exec */
+	fcntl(pair[1], F_SETFD, 0);
+	snprintf(fd, sizeof fd, "%d", pair[1]);
+	setenv(HANDOVER_ENV, fd, 1);
+	err = posix_spawn(&upgrade_pid, exe_path, NULL, NULL, arguments, environ);
+	unsetenv(HANDOVER_ENV);
+	close(pair[1]);
+
+	if(err) {
+		LOG(LOG_ERR, "Unable to start %s: %s", exe_path, strerror(err));
+		close(pair[0]);
+		return;
+	}
+
+	upgradefd = pair[0];
+	if(uring_active())
+		upgrade_watch = uring_poll(upgradefd, upgrade_ready, NULL);
+
+	LOG(LOG_INFO, "Started %s (%d) to take over", exe_path, upgrade_pid);
+}
+
+/* Pass everything to the new process, returns only if that failed */
+static void hand_over(void) {
+	unsigned char keybits[HANDOVER_DATA_SIZE];
 	evdev_t *evdev;
-	int maxfd = 0;
+	bool workers = fanout_active();
+	fanout_client_t *handed = NULL;
+	int fds[HANDOVER_MAX_FDS];
+	char priorities[HANDOVER_MAX_FDS];
+	bool ok = true;
+	int i, n, s, nfds, fd;
+
+	/* Stop reading first, so every report is read by exactly one of us */
+	flush_idle();
+	if(workers)
+		n = fanout_stop(&handed);
+	else {
+		handed = xalloc((nclients + 1) * sizeof *handed);
+		for(n = 0; n < nclients; n++) {
+			handed[n].fd = clients[n]->fd;
+			handed[n].socket = clients[n]->socket;
+			handed[n].priority = clients[n]->command.priority;
+		}
+	}
+	uring_close();
+
+	for(s = 0; ok && s < nsockets; s++)
+		ok = handover_send(upgradefd, HANDOVER_SOCKET, s, NULL, 0, &sockets[s].fd, 1);
+	for(evdev = evdevs; ok && evdev; evdev = evdev->next)
+		ok = handover_send(upgradefd, HANDOVER_DEVICE, evdev->index, evdev->path, strlen(evdev->path) + 1, &evdev->fd, 1);
+	for(s = 0; ok && s < nsockets; s++) {
+		for(i = nfds = 0; ok && i <= n; i++) {
+			if(i < n && handed[i].socket == s) {
+				priorities[nfds] = handed[i].priority;
+				fds[nfds++] = handed[i].fd;
+			}
+			if(nfds == HANDOVER_MAX_FDS || (i == n && nfds > 0)) {
+				ok = handover_send(upgradefd, HANDOVER_CLIENTS, s, priorities, nfds, fds, nfds);
+				nfds = 0;
+			}
+		}
+	}
+	if(ok && (fd = uinput_export(keybits, sizeof keybits)) >= 0)
+		ok = handover_send(upgradefd, HANDOVER_UINPUT, 0, keybits, sizeof keybits, &fd, 1);
+	/* The new binary runs as the user, it could not open the file again */
+	if(ok && capture) {
+		capture_flush(capture, UINT64_MAX);
+		fd = fileno(capture);
+		ok = handover_send(upgradefd, HANDOVER_CAPTURE, 0, NULL, 0, &fd, 1);
+	}
+	ok = ok && handover_send(upgradefd, HANDOVER_DONE, 0, NULL, 0, NULL, 0);
 
-	FD_ZERO(&permset);
-	
-	for(evdev = evdevs; evdev; evdev = evdev->next) {
-		FD_SET(evdev->fd, &permset);
-		if(evdev->fd > maxfd)
-			maxfd = evdev->fd;
+	if(ok) {
+		LOG(LOG_INFO, "Handed over to %d", upgrade_pid);
+		log_flush();
+		/* Not through main(), the device and the socket live on */
+		exit(0);
 	}
-	
-	FD_SET(sockfd, &permset);
-	if(sockfd > maxfd)
-		maxfd = sockfd;
 
-	maxfd++;
-	
+	LOG(LOG_ERR, "Handover failed: %s", strerror(errno));
+	close(upgradefd);
+	upgradefd = -1;
+
+	/* The workers are gone, serve their clients from the main loop */
+	if(workers)
+		for(i = 0; i < n; i++)
+			add_client(handed[i].fd, handed[i].socket, handed[i].priority);
+	free(handed);
+}
+
+static void processupgrade(void) {
+	handover_message_t message;
+	int fds[HANDOVER_MAX_FDS];
+
+	if(handover_receive(upgradefd, &message, fds) == 0 && message.type == HANDOVER_READY) {
+		hand_over();
+		return;
+	}
+
+	LOG(LOG_ERR, "Upgrade failed, %s did not take over", exe_path);
+	uring_cancel(upgrade_watch);
+	close(upgradefd);
+	upgradefd = -1;
+	waitpid(upgrade_pid, NULL, WNOHANG);
+}
+
+static void upgrade_ready(void *arg, unsigned long tag, int res, const void *data) {
+	processupgrade();
+}
+
+/* Take the descriptors of the daemon we replace instead of opening our own */
+static bool take_over(int sock) {
+	handover_message_t message;
+	int fds[HANDOVER_MAX_FDS];
+	bool have_uinput = false;
+	int i, n;
+
+	if(!handover_send(sock, HANDOVER_READY, 0, NULL, 0, NULL, 0)) {
+		fprintf(stderr, "Unable to reach the running daemon: %s\n", strerror(errno));
+		return false;
+	}
+
+	while((n = handover_receive(sock, &message, fds)) >= 0) {
+		message.data[HANDOVER_DATA_SIZE - 1] = '\0';
+
+		switch(message.type) {
+			case HANDOVER_SOCKET:
+				if(n > 0 && message.index >= 0 && message.index < nsockets)
+					sockets[message.index].fd = fds[0];
+				else if(n > 0)
+					close(fds[0]);
+				break;
+			case HANDOVER_DEVICE:
+				if(n > 0)
+					adopt_evdev(message.data, fds[0], message.index);
+				break;
+			case HANDOVER_CLIENTS:
+				adopted_clients = realloc(adopted_clients, (nadopted + n) * sizeof *adopted_clients);
+				if(!adopted_clients) {
+					fprintf(stderr, "Could not allocate client array: %s\n", strerror(errno));
+					return false;
+				}
+				for(i = 0; i < n; i++, nadopted++) {
+					adopted_clients[nadopted].fd = fds[i];
+					adopted_clients[nadopted].socket = message.index >= 0 && message.index < nsockets ? message.index : 0;
+					adopted_clients[nadopted].priority = i < message.len && message.data[i] >= PRIORITY_HIGH && message.data[i] <= PRIORITY_IDLE ? message.data[i] : PRIORITY_NORMAL;
+				}
+				break;
+			case HANDOVER_UINPUT:
+				if(n > 0 && use_uinput) {
+					uinput_adopt(fds[0], (unsigned char *) message.data, message.len, mymap);
+					have_uinput = true;
+				} else if(n > 0)
+					close(fds[0]);
+				break;
+			case HANDOVER_CAPTURE:
+				if(n > 0 && capture_path && !capture)
+					capture = capture_adopt(fds[0]);
+				else if(n > 0)
+					close(fds[0]);
+				break;
+			case HANDOVER_DONE:
+				close(sock);
+				for(i = 0; i < nsockets; i++)
+					if(sockets[i].fd < 0 && !add_unixsocket(&sockets[i], -1))
+						return false;
+				/* -R new to this binary, keep what an earlier capture recorded */
+				if(capture_path && !capture && !(capture = capture_create(capture_path, true)))
+					return false;
+				return !use_uinput || have_uinput || uinput_open(mymap);
+		}
+	}
+
+	fprintf(stderr, "Handover from the running daemon failed: %s\n", strerror(errno));
+	close(sock);
+	return false;
+}
+
+static void adopt_clients(void) {
+	int i;
+
+	for(i = 0; i < nadopted; i++) {
+		if(fanout_active())
+			fanout_add_client(adopted_clients[i].fd, adopted_clients[i].socket, adopted_clients[i].priority);
+		else
+			add_client(adopted_clients[i].fd, adopted_clients[i].socket, adopted_clients[i].priority);
+	}
+
+	free(adopted_clients);
+	adopted_clients = NULL;
+	nadopted = 0;
+}
+
+/* poll() set, rebuilt on every iteration, evdevs come first */
+static struct pollfd *pollfds = NULL;
+static evdev_t **pollevdevs = NULL;
+static int npollfds = 0;
+static int pollfds_size = 0;
+
+static int min_timeout(int a, int b) {
+	if(a < 0)
+		return b;
+	if(b < 0)
+		return a;
+	return a < b ? a : b;
+}
+
+static void add_fd(int fd) {
+	if(npollfds == pollfds_size) {
+		pollfds_size = pollfds_size ? 2 * pollfds_size : 64;
+		pollfds = realloc(pollfds, pollfds_size * sizeof *pollfds);
+		pollevdevs = realloc(pollevdevs, pollfds_size * sizeof *pollevdevs);
+		if(!pollfds || !pollevdevs) {
+			fprintf(stderr, "Could not allocate poll array: %s\n", strerror(errno));
+			exit(EX_OSERR);
+		}
+	}
+
+	pollfds[npollfds].fd = fd;
+	pollfds[npollfds].events = POLLIN;
+	pollfds[npollfds].revents = 0;
+	npollfds++;
+}
+
+static void main_loop(void) {
+	evdev_t *evdev;
+	int nevdevs, nclients_polled;
+	int timeout;
+	int i;
+
 	while(true) {
-		fdset = permset;
+		timeout = -1;
+
+		if(stop)
+			return;
 		
-		if(select(maxfd, &fdset, NULL, NULL, NULL) < 0) {
+		if(dump_trace) {
+			dump_trace = 0;
+			trace_dump();
+			realtime_report();
+			storm_report();
+		}
+
+		if(reload) {
+			reload = 0;
+			reload_tables();
+		}
+
+		if(upgrade) {
+			upgrade = 0;
+			start_upgrade();
+		}
+
+		if(replay && have_clients()) {
+			timeout = processreplay();
+			if(!replay)
+				return;
+		}
+
+		timeout = min_timeout(timeout, processrescan());
+		if(capture)
+			timeout = min_timeout(timeout, capture_flush(capture, getTime_ms() * 1000));
+		timeout = min_timeout(timeout, action_timeout(getTime_ms()));
+
+		if(realtime_active())
+			realtime_check();
+
+		/* Idle clients and queued log records while there is nothing else to do */
+		flush_idle();
+		log_flush();
+		action_reap();
+
+		if(uring_active()) {
+			if(uring_wait(timeout) < 0) {
+				syslog(LOG_ERR, "Error during io_uring_enter(): %s\n", strerror(errno));
+				exit(EX_OSERR);
+			}
+			continue;
+		}
+
+		/* Devices come and go, so build the set after the rescan */
+		npollfds = 0;
+		for(evdev = evdevs; evdev; evdev = evdev->next) {
+			add_fd(evdev->fd);
+			pollevdevs[npollfds - 1] = evdev;
+		}
+		nevdevs = npollfds;
+		for(i = 0; i < nclients; i++)
+			add_fd(clients[i]->fd);
+		nclients_polled = nclients;
+		for(i = 0; i < nsockets; i++)
+			add_fd(sockets[i].fd);
+		if(upgradefd >= 0)
+			add_fd(upgradefd);
+		if(hotplugfd >= 0)
+			add_fd(hotplugfd);
+
+		if(poll(pollfds, npollfds, timeout) < 0) {
 			if(errno == EINTR)
 				continue;
-			syslog(LOG_ERR, "Error during select(): %s\n", strerror(errno));
+			syslog(LOG_ERR, "Error during poll(): %s\n", strerror(errno));
 			exit(EX_OSERR);
 		}
 
-		for(evdev = evdevs; evdev; evdev = evdev->next)
-			if(FD_ISSET(evdev->fd, &fdset))
-				processevent(evdev);
+		/* Clients first, broadcasting to them may compact the array */
+		for(i = 0; i < nclients_polled; i++)
+			if(pollfds[nevdevs + i].revents)
+				processclient(clients[i]);
+		reap_clients();
+
+		for(i = 0; i < nevdevs; i++)
+			if(pollfds[i].revents)
+				processevent(pollevdevs[i]);
+
+		for(i = 0; i < nsockets; i++)
+			if(pollfds[nevdevs + nclients_polled + i].revents)
+				processnewclient(i);
 
-		if(FD_ISSET(sockfd, &fdset))
-			processnewclient();
+		if(upgradefd >= 0 && pollfds[nevdevs + nclients_polled + nsockets].revents)
+			processupgrade();
+
+		if(hotplugfd >= 0 && pollfds[npollfds - 1].revents)
+			processhotplug();
 	}
 }
 
 int main(int argc, char *argv[]) {
 	char *user = "nobody";
-	char *translation_path = NULL;
+	char *replay_path = NULL;
 	int opt;
+	int workers = 0;
+	int level = log_level;
 	bool foreground = false;
 	bool use_translationtable = false;
+	bool realtime = false;
+	int priority = 0;
+	int cpu = -1;
+	char *handover;
+	ssize_t len;
+
+	arguments = argv;
+	if((len = readlink("/proc/self/exe", exe_path, sizeof exe_path - 1)) > 0)
+		exe_path[len] = '\0';
+	else
+		snprintf(exe_path, sizeof exe_path, "%s", argv[0]);
+
+	/* Set when a running daemon started us to take over */
+	if((handover = getenv(HANDOVER_ENV)))
+		unsetenv(HANDOVER_ENV);
 	
-	while((opt = getopt(argc, argv, "d:gm:fu:r:s:t:")) != -1) {
+	while((opt = getopt(argc, argv, "d:gm:fu:r:s:t:L:T:R:P:aw:Hb:Ul:e:B:D:Q:p:S:C:")) != -1) {
         switch(opt) {
 			case 'd':
-				device = strdup(optarg);
+				if(!parse_socket(optarg)) {
+					fprintf(stderr, "Invalid socket %s\n", optarg);
+					return EX_USAGE;
+				}
 				break;
 			case 'g':
 				grab = true;
@@ -371,64 +1801,218 @@ int main(int argc, char *argv[]) {
 				use_translationtable = true;
 				translation_path = strdup(optarg);
 				break;
+			case 'T':
+				trace_init(strdup(optarg));
+				break;
+			case 'R':
+				capture_path = strdup(optarg);
+				break;
+			case 'P':
+				replay_path = strdup(optarg);
+				break;
+			case 'a':
+				replay_fast = true;
+				break;
+			case 'w':
+				workers = atoi(optarg);
+				break;
+			case 'H':
+				hotplug = true;
+				break;
+			case 'b':
+				backlog = atoi(optarg);
+				break;
+			case 'U':
+				use_uinput = true;
+				break;
+			case 'l':
+				level = atoi(optarg);
+				break;
+			case 'e':
+				action_path = strdup(optarg);
+				break;
+			case 'D':
+				dedup_init(atoi(optarg));
+				break;
+			case 'p':
+				if(!parse_user_priority(optarg)) {
+					fprintf(stderr, "Invalid priority %s\n", optarg);
+					return EX_USAGE;
+				}
+				break;
+			case 'Q':
+				if(!storm_init(optarg)) {
+					print_help();
+					return EX_USAGE;
+				}
+				break;
+			case 'S':
+				realtime = true;
+				priority = atoi(optarg);
+				if(priority < 0 || priority > sched_get_priority_max(SCHED_FIFO)) {
+					print_help();
+					return EX_USAGE;
+				}
+				break;
+			case 'C':
+				realtime = true;
+				cpu = atoi(optarg);
+				if(cpu < 0 || cpu >= CPU_SETSIZE) {
+					print_help();
+					return EX_USAGE;
+				}
+				break;
+			case 'L':
+				if(!strchr(optarg, '=') || !add_layer(strndup(optarg, strchr(optarg, '=') - optarg), strdup(strchr(optarg, '=') + 1))) {
+					print_help();
+					return EX_USAGE;
+				}
+				break;
+			case 'B':
+				if(!strcmp(optarg, "uring"))
+					use_uring = true;
+				else if(strcmp(optarg, "poll")) {
+					print_help();
+					return EX_USAGE;
+				}
+				break;
             default:
 				print_help();
                 return EX_USAGE;
         }
     }
 
-	if(argc <= optind) {
+	log_open(foreground, level);
+
+	if(argc <= optind && !replay_path) {
 		fprintf(stderr, "Not enough arguments.\n");
 		return EX_USAGE;
 	}
 
-	add_evdevs(argc - optind, argv + optind);
+	if(!nsockets)
+		parse_socket("/var/run/lirc/lircd");
+
+	patterns = argv + optind;
+	npatterns = argc - optind;
+	if(!handover)
+		scan_evdevs(true);
+
+	if(hotplug && (hotplugfd = hotplug_open()) < 0)
+		return EX_OSERR;
 
-	if(!evdevs) {
+	if(!evdevs && !replay_path && !hotplug && !handover) {
 		fprintf(stderr, "Unable to open any event device!\n");
 		return EX_OSERR;
 	}
 
+	if(replay_path && !start_replay(replay_path))
+		return EX_OSERR;
+
+	if(capture_path && !handover && !(capture = capture_create(capture_path, false)))
+		return EX_OSERR;
+
 	mymap = hashmap_new();
+	repeat_profiles_clear(&repeat_profiles);
 	
-	if(use_translationtable &&  !parse_translation_table(translation_path, mymap)) {
+	if(use_translationtable &&  !parse_translation_table(translation_path, mymap, &repeat_profiles)) {
 		hashmap_free(mymap);
 		return EX_OSERR;
 	}
 
-	if (!add_unixsocket()) {
+	if(!parse_layers(mymap)) {
+		free_translation_table(mymap);
+		return EX_OSERR;
+	}
+
+	repeat_profiles_init(&repeat_profiles, repeat_delay, repeat_period);
+
+	if(action_path && !action_open(action_path, mymap)) {
+		hashmap_free(mymap);
+		return EX_OSERR;
+	}
+
+	if(use_uinput && !handover && !uinput_open(mymap)) {
+		hashmap_free(mymap);
+		return EX_OSERR;
+	}
+
+	if(!command_build(mymap)) {
+		hashmap_free(mymap);
+		return EX_OSERR;
+	}
+
+	if(!build_views(mymap)) {
 		hashmap_free(mymap);
-		if (sockfd >= 0) close (sockfd);
 		return EX_OSERR;
 	}
 
+	if (!(handover ? take_over(atoi(handover)) : add_unixsockets())) {
+		hashmap_free(mymap);
+		close_unixsockets();
+		return EX_OSERR;
+	}
+
+	/* Raising the limits needs root, the rest happens once all is set up */
+	if(realtime)
+		realtime_prepare(priority);
+
 	struct passwd *pwd = getpwnam(user);
 	if(!pwd) {
 		fprintf(stderr, "Unable to resolve user %s!\n", user);
 		hashmap_free(mymap);
-		if (sockfd >= 0) close (sockfd);
+		close_unixsockets();
 		return EX_OSERR;
 	}
 
 	if(setgid(pwd->pw_gid) || setuid(pwd->pw_uid)) {
 		fprintf(stderr, "Unable to setuid/setguid to %s!\n", user);
 		hashmap_free(mymap);
-		if (sockfd >= 0) close (sockfd);
+		close_unixsockets();
 		return EX_OSERR;
 	}
 
-	if(!foreground)
+	/* The daemon we replace has detached already */
+	if(!foreground && !handover)
 		daemon(0, 0);
 
 	syslog(LOG_INFO, "Started");
 
 	signal(SIGPIPE, SIG_IGN);
+	signal(SIGUSR1, sigusr1_handler);
+	signal(SIGHUP, sighup_handler);
+	signal(SIGUSR2, sigusr2_handler);
+	/* The buffered records are written on the way out */
+	if(capture) {
+		signal(SIGTERM, sigterm_handler);
+		signal(SIGINT, sigterm_handler);
+	}
+
+	if(workers > 0 && !fanout_start(workers)) {
+		hashmap_free(mymap);
+		close_unixsockets();
+		return EX_OSERR;
+	}
+
+	if(use_uring && !start_uring())
+		LOG(LOG_WARNING, "Using poll() instead of io_uring");
+
+	adopt_clients();
+
+	if(realtime && !realtime_start(priority, cpu)) {
+		log_flush();
+		return EX_OSERR;
+	}
 
 	main_loop();
+	log_flush();
+	uring_close();
 
 	/* Now, destroy the map */
-	hashmap_free(mymap);
-	if (sockfd >= 0) close (sockfd);
+	uinput_close();
+	free_views();
+	free_translation_table(mymap);
+	if (capture) fclose(capture);
+	close_unixsockets();
 
 	return 0;
 }
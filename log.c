@@ -0,0 +1,230 @@
+/*
+    irmplircd -- zeroconf LIRC daemon that reads IRMP events from the USB IR Remote Receiver
+	             http://www.mikrocontroller.net/articles/USB_IR_Remote_Receiver
+    Copyright (C) 2011-2014  Dirk E. Wagner
+
+    This program is free software; you can redistribute it and/or modify it
+    under the terms of version 2 of the GNU General Public License as published
+    by the Free Software Foundation.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program; if not, write to the Free Software
+    Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301 USA
+*/
+
+ /* Standard headers */
+#include <stdio.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdatomic.h>
+#include <string.h>
+#include <time.h>
+#include <syslog.h>
+
+#include "log.h"
+
+#ifdef DEBUG
+int log_level = LOG_DEBUG;
+#else
+int log_level = LOG_INFO;
+#endif
+
+typedef struct {
+	_Atomic uint64_t seq;	// 2 * lap while free, 2 * lap + 1 once filled
+	uint64_t ts_us;
+	const char *fmt;
+	int level;
+	int nargs;
+	log_arg_t args[LOG_MAX_ARGS];
+	char strings[LOG_STRING_SPACE];
+} log_entry_t;
+
+static log_entry_t ring[LOG_RING_SIZE];
+static _Atomic uint64_t head = 0;
+static uint64_t tail = 0;
+static _Atomic unsigned long dropped = 0;
+
+static unsigned long suppressed = 0;
+static double tokens = LOG_BURST;
+static uint64_t refill_us = 0;
+
+static uint64_t getTime_us(void) {
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t)ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+}
+
+void log_open(bool foreground, int level) {
+	log_level = level;
+	openlog("irmplircd", foreground ? LOG_PERROR : 0, LOG_DAEMON);
+}
+
+/* Bounded multi producer queue, a full ring drops the record */
+void log_record(int level, int nargs, const char *fmt, const log_arg_t *args) {
+	uint64_t ticket = atomic_load_explicit(&head, memory_order_relaxed);
+	log_entry_t *entry;
+	size_t used = 0;
+	int i;
+
+	for(;;) {
+		uint64_t lap = 2 * (ticket / LOG_RING_SIZE);
+
+		entry = &ring[ticket & (LOG_RING_SIZE - 1)];
+		uint64_t seq = atomic_load_explicit(&entry->seq, memory_order_acquire);
+
+		if(seq == lap) {
+			if(atomic_compare_exchange_weak_explicit(&head, &ticket, ticket + 1, memory_order_relaxed, memory_order_relaxed))
+				break;
+		} else if(seq < lap) {
+			atomic_fetch_add_explicit(&dropped, 1, memory_order_relaxed);
+			return;
+		} else {
+			ticket = atomic_load_explicit(&head, memory_order_relaxed);
+		}
+	}
+
+	if(nargs > LOG_MAX_ARGS)
+		nargs = LOG_MAX_ARGS;
+
+	entry->ts_us = getTime_us();
+	entry->fmt = fmt;
+	entry->level = level;
+	entry->nargs = nargs;
+
+	for(i = 0; i < nargs; i++) {
+		entry->args[i] = args[i];
+		if(args[i].type == 's') {
+			const char *s = args[i].v.s ? args[i].v.s : "(null)";
+			size_t len = strnlen(s, LOG_STRING_SPACE - used - 1);
+
+			memcpy(entry->strings + used, s, len);
+			entry->strings[used + len] = '\0';
+			entry->args[i].v.s = entry->strings + used;
+			used += len + (used + len + 1 < LOG_STRING_SPACE);
+		}
+	}
+
+	atomic_store_explicit(&entry->seq, 2 * (ticket / LOG_RING_SIZE) + 1, memory_order_release);
+}
+
+/* Expand the format one conversion at a time with the recorded argument types */
+static void format_entry(const log_entry_t *entry, char *out, size_t size) {
+	const char *p = entry->fmt;
+	size_t len = 0;
+	int arg = 0;
+
+	while(*p && len < size - 1) {
+		char spec[16];
+		size_t n = 0;
+
+		if(*p != '%') {
+			out[len++] = *p++;
+			continue;
+		}
+
+		if(p[1] == '%') {
+			out[len++] = '%';
+			p += 2;
+			continue;
+		}
+
+		spec[n++] = *p++;
+		while(*p && strchr("-+ #0123456789.", *p) && n < sizeof spec - 4)
+			spec[n++] = *p++;
+		while(*p && strchr("hlLqjzt", *p))
+			p++;
+		if(!*p || arg >= entry->nargs)
+			break;
+
+		const log_arg_t *a = &entry->args[arg++];
+		int r;
+
+		switch(a->type) {
+			case 'i':
+			case 'u':
+				if(strchr("cdiouxX", *p)) {
+					if(*p != 'c') {
+						spec[n++] = 'l';
+						spec[n++] = 'l';
+					}
+					spec[n++] = *p;
+					spec[n] = '\0';
+					r = a->type == 'i' ? snprintf(out + len, size - len, spec, a->v.i) : snprintf(out + len, size - len, spec, a->v.u);
+				} else {
+					r = snprintf(out + len, size - len, "?");
+				}
+				break;
+			case 'd':
+				spec[n++] = strchr("eEfFgGaA", *p) ? *p : 'f';
+				spec[n] = '\0';
+				r = snprintf(out + len, size - len, spec, a->v.d);
+				break;
+			default:
+				spec[n++] = 's';
+				spec[n] = '\0';
+				r = snprintf(out + len, size - len, spec, a->v.s);
+				break;
+		}
+		p++;
+
+		if(r > 0)
+			len += (size_t)r < size - len ? (size_t)r : size - len - 1;
+	}
+
+	while(len > 0 && out[len - 1] == '\n')
+		len--;
+	out[len] = '\0';
+}
+
+/* Token bucket so a misbehaving receiver cannot flood syslog */
+static bool log_allowed(uint64_t now) {
+	tokens += (now - refill_us) * LOG_RATE / 1e6;
+	if(tokens > LOG_BURST)
+		tokens = LOG_BURST;
+	refill_us = now;
+
+	if(tokens < 1)
+		return false;
+
+	tokens -= 1;
+	return true;
+}
+
+void log_flush(void) {
+	uint64_t now = getTime_us();
+	unsigned long lost;
+	char line[256];
+
+	for(;;) {
+		log_entry_t *entry = &ring[tail & (LOG_RING_SIZE - 1)];
+		uint64_t lap = 2 * (tail / LOG_RING_SIZE);
+
+		if(atomic_load_explicit(&entry->seq, memory_order_acquire) != lap + 1)
+			break;
+
+		if(log_allowed(now)) {
+			format_entry(entry, line, sizeof line);
+			syslog(entry->level, "[%llu.%03llu] %s", (unsigned long long)(entry->ts_us / 1000), (unsigned long long)(entry->ts_us % 1000), line);
+		} else {
+			suppressed++;
+		}
+
+		atomic_store_explicit(&entry->seq, lap + 2, memory_order_release);
+		tail++;
+	}
+
+	lost = atomic_exchange_explicit(&dropped, 0, memory_order_relaxed);
+	if(lost)
+		syslog(LOG_WARNING, "%lu log records lost, log queue full", lost);
+
+	if(suppressed && log_allowed(now)) {
+		syslog(LOG_WARNING, "%lu log records suppressed", suppressed);
+		suppressed = 0;
+	}
+}
@@ -0,0 +1,86 @@
+/*
+    irmplircd -- zeroconf LIRC daemon that reads IRMP events from the USB IR Remote Receiver
+	             http://www.mikrocontroller.net/articles/USB_IR_Remote_Receiver
+    Copyright (C) 2011-2014  Dirk E. Wagner
+
+    This program is free software; you can redistribute it and/or modify it
+    under the terms of version 2 of the GNU General Public License as published
+    by the Free Software Foundation.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program; if not, write to the Free Software
+    Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301 USA
+*/
+
+#ifndef __LOG_H__
+#define __LOG_H__
+
+#include <syslog.h>
+
+#define LOG_RING_SIZE 1024	// records, must be a power of two
+#define LOG_MAX_ARGS 6
+#define LOG_STRING_SPACE 160	// bytes for copies of string arguments
+#define LOG_RATE 20		// records per second written once the burst is used up
+#define LOG_BURST 100
+
+/* Records above this syslog level are discarded before they are queued */
+extern int log_level;
+
+typedef struct {
+	char type;
+	union {
+		long long i;
+		unsigned long long u;
+		double d;
+		const char *s;
+	} v;
+} log_arg_t;
+
+static inline log_arg_t log_arg_i(long long i) { return (log_arg_t) { .type = 'i', .v.i = i }; }
+static inline log_arg_t log_arg_u(unsigned long long u) { return (log_arg_t) { .type = 'u', .v.u = u }; }
+static inline log_arg_t log_arg_d(double d) { return (log_arg_t) { .type = 'd', .v.d = d }; }
+static inline log_arg_t log_arg_s(const char *s) { return (log_arg_t) { .type = 's', .v.s = s }; }
+
+#define LOG_ARG(x) _Generic((x), \
+	float: log_arg_d, double: log_arg_d, \
+	char *: log_arg_s, const char *: log_arg_s, \
+	unsigned char: log_arg_u, unsigned short: log_arg_u, unsigned int: log_arg_u, \
+	unsigned long: log_arg_u, unsigned long long: log_arg_u, \
+	default: log_arg_i)(x)
+
+#define LOG_CAT(a, b) LOG_CAT_(a, b)
+#define LOG_CAT_(a, b) a##b
+#define LOG_COUNT(...) LOG_COUNT_(__VA_ARGS__, 6, 5, 4, 3, 2, 1, 0, -1)
+#define LOG_COUNT_(f, a, b, c, d, e, g, n, ...) n
+#define LOG_FORMAT(f, ...) f
+#define LOG_ARGS_0(f) LOG_ARG(0)
+#define LOG_ARGS_1(f, a) LOG_ARG(a)
+#define LOG_ARGS_2(f, a, ...) LOG_ARG(a), LOG_ARGS_1(f, __VA_ARGS__)
+#define LOG_ARGS_3(f, a, ...) LOG_ARG(a), LOG_ARGS_2(f, __VA_ARGS__)
+#define LOG_ARGS_4(f, a, ...) LOG_ARG(a), LOG_ARGS_3(f, __VA_ARGS__)
+#define LOG_ARGS_5(f, a, ...) LOG_ARG(a), LOG_ARGS_4(f, __VA_ARGS__)
+#define LOG_ARGS_6(f, a, ...) LOG_ARG(a), LOG_ARGS_5(f, __VA_ARGS__)
+
+/*
+ * Queue a log record without formatting it. The format must be a string
+ * literal, string arguments are copied. Formatting and output happen in
+ * log_flush(), called by the main loop when it is idle.
+ */
+#define LOG(level, ...) do { \
+	if ((level) <= log_level) \
+		log_record((level), LOG_COUNT(__VA_ARGS__), LOG_FORMAT(__VA_ARGS__, 0), \
+			(log_arg_t[]) { LOG_CAT(LOG_ARGS_, LOG_COUNT(__VA_ARGS__))(__VA_ARGS__) }); \
+} while (0)
+
+void log_open(bool foreground, int level);
+void log_record(int level, int nargs, const char *fmt, const log_arg_t *args);
+
+/* Format and write all queued records */
+void log_flush(void);
+
+#endif
@@ -41,14 +41,210 @@
 #include "debug.h"
 #include "hashmap.h"
 #include "mapping.h"
+#include "uinput.h"
 
-bool parse_translation_table(const char *path, map_t mymap) {
+#define HEX_DIGITS "0123456789abcdefABCDEF"
+
+/* profiles has to be zeroed or cleared before, address overrides are freed */
+void repeat_profiles_clear(repeat_profiles_t *profiles) {
+	repeat_timing_t *timing;
+	int i;
+
+	for(i = 0; i < PROTOCOL_COUNT; i++) {
+		profiles->protocols[i].delay = -1;
+		profiles->protocols[i].period = -1;
+		profiles->protocols[i].next = NULL;
+		while((timing = profiles->addresses[i])) {
+			profiles->addresses[i] = timing->next;
+			free(timing);
+		}
+	}
+}
+
+/* Protocols without a profile of their own get the global timing */
+void repeat_profiles_init(repeat_profiles_t *profiles, int delay, int period) {
+	repeat_timing_t *timing;
+	int i;
+
+	for(i = 0; i < PROTOCOL_COUNT; i++) {
+		if(profiles->protocols[i].delay < 0)
+			profiles->protocols[i].delay = delay;
+		if(profiles->protocols[i].period < 0)
+			profiles->protocols[i].period = period;
+
+		for(timing = profiles->addresses[i]; timing; timing = timing->next) {
+			if(timing->delay < 0)
+				timing->delay = profiles->protocols[i].delay;
+			if(timing->period < 0)
+				timing->period = profiles->protocols[i].period;
+		}
+	}
+}
+
+const repeat_timing_t *repeat_profile(const repeat_profiles_t *profiles, uint8_t protocol, uint16_t address) {
+	const repeat_timing_t *timing;
+
+	for(timing = profiles->addresses[protocol]; timing; timing = timing->next)
+		if(timing->address == address)
+			return timing;
+
+	return &profiles->protocols[protocol];
+}
+
+static bool parse_repeat_profile(const char *line, repeat_profiles_t *profiles) {
+	unsigned int protocol, address;
+	int delay, period;
+	repeat_timing_t *timing;
+
+	if(sscanf(line, "repeat %x %x %d %d", &protocol, &address, &delay, &period) == 4) {
+		if(protocol >= PROTOCOL_COUNT || address > 0xffff)
+			return false;
+		timing = malloc(sizeof *timing);
+		if(!timing)
+			return false;
+		timing->address = address;
+		timing->next = profiles->addresses[protocol];
+		profiles->addresses[protocol] = timing;
+	} else if(sscanf(line, "repeat %x %d %d", &protocol, &delay, &period) == 3) {
+		if(protocol >= PROTOCOL_COUNT)
+			return false;
+		timing = &profiles->protocols[protocol];
+	} else {
+		return false;
+	}
+
+	DBG ("parse_repeat_profile: protocol = %02x, delay = %d, period = %d\n", protocol, delay, period);
+
+	timing->delay = delay;
+	timing->period = period;
+	return true;
+}
+
+/* A field of digits hex digits or ? for any digit, or a range like 0001-000a */
+static bool parse_rule_field(const char *text, int digits, rule_field_t *field) {
+	size_t len = strlen(text);
+	unsigned int lo, hi, digit;
+	int shift;
+	size_t i;
+
+	memset(field, 0, sizeof *field);
+
+	if(len > 2 * digits + 1)
+		return false;
+
+	if(strchr(text, '-')) {
+		if(strspn(text, HEX_DIGITS "-") != len || text[0] == '-' || sscanf(text, "%x-%x", &lo, &hi) != 2 || lo > hi || hi >> (4 * digits))
+			return false;
+		field->lo = lo;
+		field->hi = hi;
+		return true;
+	}
+
+	if(len < 1 || len > digits || strspn(text, HEX_DIGITS "?") != len)
+		return false;
+
+	for(i = 0; i < len; i++) {
+		shift = 4 * (len - 1 - i);
+		if(text[i] == '?') {
+			field->hi |= 0xf << shift;
+			continue;
+		}
+		digit = strchr(HEX_DIGITS, tolower((unsigned char) text[i])) - HEX_DIGITS;
+		field->lo |= digit << shift;
+		field->hi |= digit << shift;
+		field->mask |= 0xf << shift;
+	}
+	field->bits = field->lo;
+	return true;
+}
+
+static int add_rule(map_t mymap, const rule_t *proto, int layer, int *order, const char *value) {
+	rule_t *rule = malloc(sizeof *rule);
+
+	if(!rule)
+		return MAP_OMEM;
+
+	*rule = *proto;
+	snprintf(rule->entry.value, KEY_MAX_LENGTH, "%s", value);
+	rule->entry.rule = ++*order;
+
+	return hashmap_put_u64(mymap, RULE_KEY(layer, *order), rule);
+}
+
+/*
+ * "<protocol> <address> <command> <value>", a value like KEY_1-KEY_0 maps a
+ * command range onto as many consecutive key codes. Returns MAP_MISSING if
+ * the line is not a rule.
+ */
+static int parse_rule(const char *line, map_t mymap, int layer, int *order) {
+	char protocol[KEY_MAX_LENGTH], address[KEY_MAX_LENGTH], command[KEY_MAX_LENGTH];
+	char value[KEY_MAX_LENGTH], first[KEY_MAX_LENGTH], last[KEY_MAX_LENGTH];
+	int count, base, from, to, step, i, error;
+	const char *name;
+	rule_t rule;
+	size_t len;
+
+	if(sscanf(line, "%31s %31s %31s %31[^\n]", protocol, address, command, value) != 4)
+		return MAP_MISSING;
+
+	memset(&rule, 0, sizeof rule);
+	if(!parse_rule_field(protocol, 2, &rule.protocol) || !parse_rule_field(address, 4, &rule.address) ||
+	   !parse_rule_field(command, 4, &rule.command))
+		return MAP_MISSING;
+
+	snprintf(rule.entry.key, KEY_MAX_LENGTH, "%.5s %.9s %.9s", protocol, address, command);
+	rule.entry.keycode = -1;
+	rule.entry.token = rule.entry.release_token = -1;
+	rule.entry.layer = layer;
+
+	DBG ("parse_rule: key = %s, value = %s\n", rule.entry.key, value);
+
+	/* A key range needs a contiguous command range of the same length */
+	len = strcspn(value, " \t\r");
+	count = rule.command.hi - rule.command.lo + 1;
+	if(sscanf(value, "%31[A-Z0-9_]-%31[A-Z0-9_]", first, last) != 2 || strlen(first) + strlen(last) + 1 != len ||
+	   (from = keycode_lookup(first)) < 0 || (to = keycode_lookup(last)) < 0)
+		return add_rule(mymap, &rule, layer, order, value);
+
+	step = from <= to ? 1 : -1;
+	if((rule.command.mask && ((rule.command.lo ^ rule.command.hi) & ((rule.command.lo ^ rule.command.hi) + 1))) ||
+	   count != abs(to - from) + 1)
+		return MAP_MISSING;
+
+	for(i = 0; i < count; i++)
+		if(!keycode_name(from + i * step))
+			return MAP_MISSING;
+
+	base = rule.command.lo;
+	for(i = 0, error = MAP_OK; i < count && error == MAP_OK; i++) {
+		name = keycode_name(from + i * step);
+		rule.command.lo = rule.command.hi = rule.command.bits = base + i;
+		rule.command.mask = 0xffff;
+		error = add_rule(mymap, &rule, layer, order, name);
+	}
+
+	return error;
+}
+
+static int free_entry(any_t item, any_t data) {
+	free(data);
+	return MAP_OK;
+}
+
+void free_translation_table(map_t mymap) {
+	if(hashmap_length(mymap) > 0)
+		hashmap_iterate(mymap, free_entry, NULL);
+	hashmap_free(mymap);
+}
+
+static bool parse_table(const char *path, map_t mymap, repeat_profiles_t *profiles, int layer) {
 	FILE *table;
 	char *line = NULL;
 	size_t line_size = 0;
 	char key[KEY_MAX_LENGTH];
 	char value[KEY_MAX_LENGTH];
 	int error = 0;
+	int order = 0;
 	int len;
 
 	key[0] = value[0] = 0;	
@@ -66,7 +262,13 @@ bool parse_translation_table(const char *path, map_t mymap) {
 		if (strcspn(line, "\n\r#") == 0)
 			continue;
 
-		len = sscanf(line, "%99s %99[^\n]", key, value);
+		if (strncmp(line, "repeat ", 7) == 0) {
+			if (!profiles || !parse_repeat_profile(line, profiles))
+				syslog(LOG_ERR, "line ignored: %s\n", line);
+			continue;
+		}
+
+		len = sscanf(line, "%31s %31[^\n]", key, value);
 		if(len != 2) {
 			syslog(LOG_ERR, "line ignored: %s\n", line);
 			continue;
@@ -77,13 +279,25 @@ bool parse_translation_table(const char *path, map_t mymap) {
 		if(strlen(key) < 1 || strlen(value) < 1)
 			continue;
 
-		DBG ("parse_translation_table: key = %s, value = %s\n", key, value);
-		
-		map_entry_t *map_entry = malloc(sizeof(map_entry_t));
-  		snprintf(map_entry->key, KEY_MAX_LENGTH, "%s", key);
-		snprintf(map_entry->value, KEY_MAX_LENGTH, "%s", value);
+		if(strlen(key) != 12 || strspn(key, HEX_DIGITS) != 12) {
+			error = parse_rule(line, mymap, layer, &order);
+			if(error == MAP_MISSING) {
+				syslog(LOG_ERR, "line ignored, key is not an IRMP code or rule: %s\n", line);
+				continue;
+			}
+		} else {
+			DBG ("parse_translation_table: key = %s, value = %s\n", key, value);
+
+			map_entry_t *map_entry = malloc(sizeof(map_entry_t));
+			snprintf(map_entry->key, KEY_MAX_LENGTH, "%s", key);
+			snprintf(map_entry->value, KEY_MAX_LENGTH, "%s", value);
+			map_entry->keycode = -1;
+			map_entry->token = map_entry->release_token = -1;
+			map_entry->layer = layer;
+			map_entry->rule = 0;
 
-		error = hashmap_put(mymap, map_entry->key, map_entry);			
+			error = hashmap_put_u64(mymap, LAYER_KEY(layer, strtoull(key, NULL, 16)), map_entry);
+		}
 
 		if(error) {
 			fprintf(stderr, "hashmap_put failure: %d\n", error);
@@ -98,3 +312,47 @@ bool parse_translation_table(const char *path, map_t mymap) {
 	
 	return true;
 }
+
+bool parse_translation_table(const char *path, map_t mymap, repeat_profiles_t *profiles) {
+	return parse_table(path, mymap, profiles, 0);
+}
+
+/* Repeat timings stay global, they are keyed by protocol and address already */
+bool parse_layer_table(const char *path, map_t mymap, int layer) {
+	if(layer <= 0 || layer >= LAYER_COUNT)
+		return false;
+
+	return parse_table(path, mymap, NULL, layer);
+}
+
+typedef struct {
+	map_t view;
+	int layer;
+} view_t;
+
+static int add_view_entry(any_t item, any_t data) {
+	view_t *view = item;
+	map_entry_t *map_entry = data;
+
+	/* Rules are matched through their own index */
+	if(map_entry->layer != view->layer || map_entry->rule)
+		return MAP_OK;
+
+	return hashmap_put_u64(view->view, strtoull(map_entry->key, NULL, 16), map_entry);
+}
+
+map_t translation_view(map_t mymap, int layer) {
+	view_t view = { hashmap_new(), 0 };
+
+	if(!view.view || hashmap_length(mymap) <= 0)
+		return view.view;
+
+	/* Global entries first, the layer's own ones replace them */
+	if(hashmap_iterate(mymap, add_view_entry, &view) != MAP_OK ||
+	   (view.layer = layer, hashmap_iterate(mymap, add_view_entry, &view)) != MAP_OK) {
+		hashmap_free(view.view);
+		return NULL;
+	}
+
+	return view.view;
+}
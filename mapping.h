@@ -26,11 +26,82 @@
  
 #define KEY_MAX_LENGTH (32)
 
+#define PROTOCOL_COUNT (256)
+
+/* Translation table key of an IRMP code, the value of its 12 hex digits */
+#define IRMP_KEY(protocol, address, command) \
+	(((uint64_t) (protocol) << 40) | ((uint64_t) (address) << 24) | ((uint64_t) (command) << 8))
+
+/* Layers keep their entries above the 48 bits of the IRMP codes, 0 is the global table */
+#define LAYER_COUNT (1 << 15)
+#define LAYER_KEY(layer, key) (((uint64_t) (layer) << 48) | (key))
+
+/* Wildcard and range rules are keyed by their order in the table */
+#define RULE_KEY(layer, order) ((1ULL << 63) | LAYER_KEY(layer, order))
+
 typedef struct {
 	char key[KEY_MAX_LENGTH];
 	char value[KEY_MAX_LENGTH];
+	int keycode;	// input event code of value, -1 if not resolved
+	int token;	// action sequence tokens of value and value_UP, -1 if not used
+	int release_token;
+	int layer;	// translation table layer the entry belongs to
+	int rule;	// order of a wildcard or range rule in its table, 0 for IRMP codes
 } map_entry_t;
 
-bool parse_translation_table(const char *path, map_t mymap);
+/* Matches a value v if lo <= v <= hi and (v & mask) == bits */
+typedef struct {
+	uint16_t lo;
+	uint16_t hi;
+	uint16_t mask;
+	uint16_t bits;
+} rule_field_t;
+
+/*
+ * Translation table entry of a line like "15 ???? 0001-000a KEY_1" with
+ * fields that are hex values, hex digits with ? for any digit or ranges.
+ */
+typedef struct {
+	map_entry_t entry;	// first, so freeing the entry frees the rule
+	rule_field_t protocol;
+	rule_field_t address;
+	rule_field_t command;
+} rule_t;
+
+
+typedef struct repeat_timing {
+	int delay;		// delay for the first repeat in ms, -1 if not set
+	int period;		// delay for further repeats in ms, -1 if not set
+	uint16_t address;	// remote address for per address timings
+	struct repeat_timing *next;
+} repeat_timing_t;
+
+/*
+ * Repeat timings declared in the translation table with
+ *   repeat <protocol> [<address>] <delay> <period>
+ * indexed by IRMP protocol, with per address overrides.
+ */
+typedef struct {
+	repeat_timing_t protocols[PROTOCOL_COUNT];
+	repeat_timing_t *addresses[PROTOCOL_COUNT];
+} repeat_profiles_t;
+
+void repeat_profiles_clear(repeat_profiles_t *profiles);
+void repeat_profiles_init(repeat_profiles_t *profiles, int delay, int period);
+const repeat_timing_t *repeat_profile(const repeat_profiles_t *profiles, uint8_t protocol, uint16_t address);
+
+bool parse_translation_table(const char *path, map_t mymap, repeat_profiles_t *profiles);
+
+/* Add the table of a device layer, its entries are keyed with LAYER_KEY() */
+bool parse_layer_table(const char *path, map_t mymap, int layer);
+
+/*
+ * Merge a layer over the global table into a map of its own, keyed by
+ * IRMP_KEY() like the global table. The entries stay owned by mymap.
+ */
+map_t translation_view(map_t mymap, int layer);
+
+/* Free the map together with its entries */
+void free_translation_table(map_t mymap);
 
 #endif
\ No newline at end of file
@@ -0,0 +1,168 @@
+/*
+    irmplircd -- zeroconf LIRC daemon that reads IRMP events from the USB IR Remote Receiver
+	             http://www.mikrocontroller.net/articles/USB_IR_Remote_Receiver
+    Copyright (C) 2011-2014  Dirk E. Wagner
+
+    This program is free software; you can redistribute it and/or modify it
+    under the terms of version 2 of the GNU General Public License as published
+    by the Free Software Foundation.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program; if not, write to the Free Software
+    Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301 USA
+*/
+
+
+#define _GNU_SOURCE
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <malloc.h>
+#include <sched.h>
+#include <time.h>
+#include <sys/mman.h>
+#include <sys/resource.h>
+
+#include "debug.h"
+#include "log.h"
+#include "realtime.h"
+
+static bool active = false;
+static long start_faults = 0;
+static long reported_faults = 0;
+static size_t start_heap = 0;
+static uint64_t checked_ms = 0;
+
+static uint64_t getTime_ms(void) {
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t) ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+}
+
+static long faults(void) {
+	struct rusage usage;
+
+	if(getrusage(RUSAGE_THREAD, &usage) < 0)
+		return 0;
+
+	return usage.ru_minflt + usage.ru_majflt;
+}
+
+static size_t heap(void) {
+	struct mallinfo2 info = mallinfo2();
+
+	return info.arena + info.hblkhd;
+}
+
+/* Grow the stack now, a locked page it grows into later would still fault */
+static void __attribute__((noinline)) prefault_stack(void) {
+	volatile char stack[REALTIME_STACK_PREFAULT];
+
+	memset((char *) stack, 0, sizeof stack);
+}
+
+static bool prefault_heap(void) {
+	char *buf;
+
+	/* Freed memory stays in the heap and nothing bypasses it with mmap() */
+	if(!mallopt(M_TRIM_THRESHOLD, -1) || !mallopt(M_MMAP_MAX, 0))
+		return false;
+
+	if(!(buf = malloc(REALTIME_HEAP_PREFAULT)))
+		return false;
+	memset(buf, 0, REALTIME_HEAP_PREFAULT);
+	free(buf);
+	return true;
+}
+
+void realtime_prepare(int priority) {
+	struct rlimit memlock = { RLIM_INFINITY, RLIM_INFINITY };
+	struct rlimit rtprio = { priority, priority };
+
+	/* Without privileges the limits set by the administrator have to do */
+	if(setrlimit(RLIMIT_MEMLOCK, &memlock) < 0)
+		DBG("realtime: keeping the memory lock limit: %s\n", strerror(errno));
+	if(priority > 0 && setrlimit(RLIMIT_RTPRIO, &rtprio) < 0)
+		DBG("realtime: keeping the real-time priority limit: %s\n", strerror(errno));
+}
+
+bool realtime_start(int priority, int cpu) {
+	struct sched_param param = { .sched_priority = priority };
+	cpu_set_t cpus;
+
+	prefault_stack();
+	if(!prefault_heap()) {
+		LOG(LOG_ERR, "Unable to pre-fault the heap");
+		return false;
+	}
+
+	if(mlockall(MCL_CURRENT | MCL_FUTURE) < 0) {
+		LOG(LOG_ERR, "Unable to lock memory: %s", strerror(errno));
+		return false;
+	}
+
+	if(cpu >= 0) {
+		CPU_ZERO(&cpus);
+		CPU_SET(cpu, &cpus);
+		if(sched_setaffinity(0, sizeof cpus, &cpus) < 0) {
+			LOG(LOG_ERR, "Unable to pin the event loop to CPU %d: %s", cpu, strerror(errno));
+			return false;
+		}
+	}
+
+	/* Actions and the upgrade binary are spawned from this thread, they start with normal scheduling */
+	if(priority > 0 && sched_setscheduler(0, SCHED_FIFO | SCHED_RESET_ON_FORK, &param) < 0) {
+		LOG(LOG_ERR, "Unable to set SCHED_FIFO priority %d: %s", priority, strerror(errno));
+		return false;
+	}
+
+	active = true;
+	start_heap = heap();
+	start_faults = faults();
+	reported_faults = 0;
+	checked_ms = getTime_ms();
+
+	LOG(LOG_INFO, "Real-time mode, priority %d, CPU %d, memory locked", priority, cpu);
+	return true;
+}
+
+bool realtime_active(void) {
+	return active;
+}
+
+long realtime_faults(void) {
+	return active ? faults() - start_faults : 0;
+}
+
+void realtime_check(void) {
+	uint64_t now = getTime_ms();
+	long n;
+
+	/* getrusage() is a system call, the clock is not */
+	if(now - checked_ms < REALTIME_CHECK_MS)
+		return;
+	checked_ms = now;
+
+	n = realtime_faults();
+	if(n > reported_faults) {
+		LOG(LOG_WARNING, "%ld page faults in the event loop since real-time setup", n);
+		reported_faults = n;
+	}
+}
+
+void realtime_report(void) {
+	if(!active)
+		return;
+
+	LOG(LOG_INFO, "Real-time: %ld page faults, heap grew by %ld bytes since setup",
+	    realtime_faults(), (long) (heap() - start_heap));
+}
@@ -0,0 +1,54 @@
+/*
+    irmplircd -- zeroconf LIRC daemon that reads IRMP events from the USB IR Remote Receiver
+	             http://www.mikrocontroller.net/articles/USB_IR_Remote_Receiver
+    Copyright (C) 2011-2014  Dirk E. Wagner
+
+    This program is free software; you can redistribute it and/or modify it
+    under the terms of version 2 of the GNU General Public License as published
+    by the Free Software Foundation.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program; if not, write to the Free Software
+    Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301 USA
+*/
+
+
+#ifndef __REALTIME_H__
+#define __REALTIME_H__
+
+#define REALTIME_STACK_PREFAULT  (256 * 1024)	/* bytes of stack touched before locking */
+#define REALTIME_HEAP_PREFAULT   (1024 * 1024)	/* bytes of heap kept mapped for later allocations */
+#define REALTIME_CHECK_MS        (1000)	/* least time between two page fault checks */
+
+/*
+ * Opt-in real-time mode for the event loop. realtime_prepare() raises the
+ * memory lock and real-time priority limits while we are still root, so
+ * realtime_start() also works after dropping privileges and daemonizing.
+ * realtime_start() runs once setup is done: it pre-faults stack and heap,
+ * locks all memory, pins the calling thread to cpu unless that is -1 and
+ * switches it to SCHED_FIFO unless priority is 0. Threads that already
+ * run, like the fanout workers, keep their scheduling, and processes it
+ * spawns start with the normal one.
+ */
+void realtime_prepare(int priority);
+bool realtime_start(int priority, int cpu);
+bool realtime_active(void);
+
+/*
+ * Page faults of the event loop since realtime_start(). With memory locked
+ * and pre-faulted there should be none, one means the heap grew or memory
+ * was mapped in steady state. realtime_check() warns when there are new ones,
+ * looking at most every REALTIME_CHECK_MS.
+ */
+long realtime_faults(void);
+void realtime_check(void);
+
+/* Log the faults and the heap growth since realtime_start() */
+void realtime_report(void);
+
+#endif
@@ -0,0 +1,344 @@
+/*
+    irmplircd -- zeroconf LIRC daemon that reads IRMP events from the USB IR Remote Receiver
+	             http://www.mikrocontroller.net/articles/USB_IR_Remote_Receiver
+    Copyright (C) 2011-2014  Dirk E. Wagner
+
+    This program is free software; you can redistribute it and/or modify it
+    under the terms of version 2 of the GNU General Public License as published
+    by the Free Software Foundation.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program; if not, write to the Free Software
+    Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301 USA
+*/
+
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdlib.h>
+
+#include "hashmap.h"
+#include "mapping.h"
+#include "rule.h"
+
+typedef struct {
+	uint32_t start;		// first command of the interval
+	int first;		// its rules start at rules[first]
+} segment_t;
+
+typedef struct {
+	segment_t *segments;	// sorted, one more marks the end of the last rule list
+	int nsegments;
+	const rule_t **rules;	// rules of all intervals in priority order
+	int nrules;
+} bucket_t;
+
+typedef struct {
+	uint16_t address;
+	bucket_t *bucket;	// the rules of this single address
+} exact_t;
+
+typedef struct {
+	exact_t *exact;		// sorted by address
+	int nexact;
+	bucket_t *ranged;	// the rules spanning more addresses, or NULL
+} table_t;
+
+struct rule_index {
+	table_t *protocols[PROTOCOL_COUNT];
+	table_t *shared;	// of the protocols only wildcard rules cover
+};
+
+typedef struct {
+	const rule_t **rules;
+	int nrules;
+	int layer;
+} collect_t;
+
+static bool field_match(const rule_field_t *field, uint16_t value) {
+	return value >= field->lo && value <= field->hi && (value & field->mask) == field->bits;
+}
+
+static bool any_protocol(const rule_t *rule) {
+	return rule->protocol.lo == 0 && rule->protocol.hi >= PROTOCOL_COUNT - 1 && !rule->protocol.mask;
+}
+
+static int collect_rule(any_t item, any_t data) {
+	collect_t *collect = item;
+	map_entry_t *map_entry = data;
+
+	if(map_entry->rule && (map_entry->layer == collect->layer || map_entry->layer == 0))
+		collect->rules[collect->nrules++] = (const rule_t *) map_entry;
+
+	return MAP_OK;
+}
+
+/* The layer's own rules before the global ones, each in table order */
+static int compare_rules(const void *a, const void *b) {
+	const map_entry_t *x = &(*(const rule_t **) a)->entry;
+	const map_entry_t *y = &(*(const rule_t **) b)->entry;
+
+	if((x->layer == 0) != (y->layer == 0))
+		return x->layer == 0 ? 1 : -1;
+
+	return x->rule - y->rule;
+}
+
+static int compare_starts(const void *a, const void *b) {
+	uint32_t x = *(const uint32_t *) a;
+	uint32_t y = *(const uint32_t *) b;
+
+	return x < y ? -1 : x > y;
+}
+
+static void free_bucket(bucket_t *bucket) {
+	if(!bucket)
+		return;
+
+	free(bucket->segments);
+	free(bucket->rules);
+	free(bucket);
+}
+
+static bucket_t *new_bucket(const rule_t **rules, int nrules) {
+	bucket_t *bucket = calloc(1, sizeof *bucket);
+	uint32_t *starts = malloc((2 * nrules + 1) * sizeof *starts);
+	const rule_t **list;
+	int nstarts = 0, size = nrules, i, j;
+
+	if(!bucket || !starts || !(bucket->rules = malloc(size * sizeof *bucket->rules)))
+		goto fail;
+
+	/* Intervals start at 0 and wherever a rule's command range starts or ends */
+	starts[nstarts++] = 0;
+	for(i = 0; i < nrules; i++) {
+		starts[nstarts++] = rules[i]->command.lo;
+		if(rules[i]->command.hi < 0xffff)
+			starts[nstarts++] = rules[i]->command.hi + 1;
+	}
+	qsort(starts, nstarts, sizeof *starts, compare_starts);
+	for(i = j = 1; i < nstarts; i++)
+		if(starts[i] != starts[j - 1])
+			starts[j++] = starts[i];
+	nstarts = j;
+
+	if(!(bucket->segments = malloc((nstarts + 1) * sizeof *bucket->segments)))
+		goto fail;
+
+	for(i = 0; i < nstarts; i++) {
+		bucket->segments[i].start = starts[i];
+		bucket->segments[i].first = bucket->nrules;
+
+		for(j = 0; j < nrules; j++) {
+			if(starts[i] < rules[j]->command.lo || starts[i] > rules[j]->command.hi)
+				continue;
+			if(bucket->nrules == size) {
+				size *= 2;
+				if(!(list = realloc(bucket->rules, size * sizeof *list)))
+					goto fail;
+				bucket->rules = list;
+			}
+			bucket->rules[bucket->nrules++] = rules[j];
+		}
+	}
+	bucket->segments[nstarts].start = 0x10000;
+	bucket->segments[nstarts].first = bucket->nrules;
+	bucket->nsegments = nstarts;
+
+	free(starts);
+	return bucket;
+
+fail:
+	free(starts);
+	free_bucket(bucket);
+	return NULL;
+}
+
+static bool exact_address(const rule_t *rule) {
+	return rule->address.lo == rule->address.hi;
+}
+
+static int compare_addresses(const void *a, const void *b) {
+	const rule_t *x = *(const rule_t **) a;
+	const rule_t *y = *(const rule_t **) b;
+
+	return x->address.lo < y->address.lo ? -1 : x->address.lo > y->address.lo;
+}
+
+static void free_table(table_t *table) {
+	int i;
+
+	if(!table)
+		return;
+
+	for(i = 0; i < table->nexact; i++)
+		free_bucket(table->exact[i].bucket);
+	free(table->exact);
+	free_bucket(table->ranged);
+	free(table);
+}
+
+/* Rules of a single address get a bucket per address, the others share one */
+static table_t *new_table(const rule_t **rules, int nrules) {
+	table_t *table = calloc(1, sizeof *table);
+	const rule_t **sorted = malloc(nrules * sizeof *sorted);
+	int nsorted, nranged, i, j;
+
+	if(!table || !sorted)
+		goto fail;
+
+	for(i = nsorted = 0; i < nrules; i++)
+		if(exact_address(rules[i]))
+			sorted[nsorted++] = rules[i];
+	for(i = 0, nranged = nsorted; i < nrules; i++)
+		if(!exact_address(rules[i]))
+			sorted[nranged++] = rules[i];
+	if(nranged > nsorted && !(table->ranged = new_bucket(&sorted[nsorted], nranged - nsorted)))
+		goto fail;
+
+	/* qsort is not stable, so each address is put back in priority order */
+	qsort(sorted, nsorted, sizeof *sorted, compare_addresses);
+	if(nsorted && !(table->exact = malloc(nsorted * sizeof *table->exact)))
+		goto fail;
+
+	for(i = 0; i < nsorted; i = j) {
+		for(j = i + 1; j < nsorted && sorted[j]->address.lo == sorted[i]->address.lo; j++)
+			;
+		qsort(&sorted[i], j - i, sizeof *sorted, compare_rules);
+		table->exact[table->nexact].address = sorted[i]->address.lo;
+		if(!(table->exact[table->nexact].bucket = new_bucket(&sorted[i], j - i)))
+			goto fail;
+		table->nexact++;
+	}
+
+	free(sorted);
+	return table;
+
+fail:
+	free(sorted);
+	free_table(table);
+	return NULL;
+}
+
+void rule_index_free(rule_index_t *index) {
+	int p;
+
+	if(!index)
+		return;
+
+	for(p = 0; p < PROTOCOL_COUNT; p++)
+		if(index->protocols[p] != index->shared)
+			free_table(index->protocols[p]);
+	free_table(index->shared);
+	free(index);
+}
+
+rule_index_t *rule_index_new(map_t mymap, int layer) {
+	rule_index_t *index = calloc(1, sizeof *index);
+	collect_t collect = { NULL, 0, layer };
+	const rule_t **matching = NULL;
+	int nmatching, nany, p, i;
+	bool own;
+
+	if(!index)
+		return NULL;
+
+	if(hashmap_length(mymap) <= 0)
+		return index;
+
+	collect.rules = malloc(hashmap_length(mymap) * sizeof *collect.rules);
+	matching = malloc(hashmap_length(mymap) * sizeof *matching);
+	if(!collect.rules || !matching)
+		goto fail;
+
+	hashmap_iterate(mymap, collect_rule, &collect);
+	qsort(collect.rules, collect.nrules, sizeof *collect.rules, compare_rules);
+
+	for(i = nany = 0; i < collect.nrules; i++)
+		if(any_protocol(collect.rules[i]))
+			matching[nany++] = collect.rules[i];
+	if(nany && !(index->shared = new_table(matching, nany)))
+		goto fail;
+
+	/* Protocols without rules of their own share the bucket of the wildcard rules */
+	for(p = 0; p < PROTOCOL_COUNT; p++) {
+		for(i = nmatching = 0, own = false; i < collect.nrules; i++) {
+			if(!field_match(&collect.rules[i]->protocol, p))
+				continue;
+			own |= !any_protocol(collect.rules[i]);
+			matching[nmatching++] = collect.rules[i];
+		}
+
+		if(!own)
+			index->protocols[p] = index->shared;
+		else if(!(index->protocols[p] = new_table(matching, nmatching)))
+			goto fail;
+	}
+
+	free(collect.rules);
+	free(matching);
+	return index;
+
+fail:
+	free(collect.rules);
+	free(matching);
+	rule_index_free(index);
+	return NULL;
+}
+
+static const rule_t *bucket_lookup(const bucket_t *bucket, uint16_t address, uint16_t command) {
+	const segment_t *segment;
+	int lo, hi, mid, i;
+
+	if(!bucket)
+		return NULL;
+
+	/* The last interval starting at or before command */
+	for(lo = 0, hi = bucket->nsegments - 1; lo < hi; ) {
+		mid = (lo + hi + 1) / 2;
+		if(bucket->segments[mid].start <= command)
+			lo = mid;
+		else
+			hi = mid - 1;
+	}
+
+	segment = &bucket->segments[lo];
+	for(i = segment->first; i < segment[1].first; i++)
+		if(field_match(&bucket->rules[i]->address, address) && field_match(&bucket->rules[i]->command, command))
+			return bucket->rules[i];
+
+	return NULL;
+}
+
+map_entry_t *rule_lookup(const rule_index_t *index, uint8_t protocol, uint16_t address, uint16_t command) {
+	const table_t *table = index ? index->protocols[protocol] : NULL;
+	const rule_t *exact = NULL, *ranged;
+	int lo, hi, mid;
+
+	if(!table)
+		return NULL;
+
+	for(lo = 0, hi = table->nexact - 1; lo <= hi; ) {
+		mid = (lo + hi) / 2;
+		if(table->exact[mid].address == address) {
+			exact = bucket_lookup(table->exact[mid].bucket, address, command);
+			break;
+		}
+		if(table->exact[mid].address < address)
+			lo = mid + 1;
+		else
+			hi = mid - 1;
+	}
+
+	/* Both hits are the first of their kind, the table order picks between them */
+	ranged = bucket_lookup(table->ranged, address, command);
+	if(!ranged || (exact && compare_rules(&exact, &ranged) < 0))
+		ranged = exact;
+
+	return ranged ? (map_entry_t *) &ranged->entry : NULL;
+}
@@ -0,0 +1,42 @@
+/*
+    irmplircd -- zeroconf LIRC daemon that reads IRMP events from the USB IR Remote Receiver
+	             http://www.mikrocontroller.net/articles/USB_IR_Remote_Receiver
+    Copyright (C) 2011-2014  Dirk E. Wagner
+
+    This program is free software; you can redistribute it and/or modify it
+    under the terms of version 2 of the GNU General Public License as published
+    by the Free Software Foundation.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program; if not, write to the Free Software
+    Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301 USA
+*/
+
+
+#ifndef __RULE_H__
+#define __RULE_H__
+
+/*
+ * Index of the wildcard and range rules of a translation table layer,
+ * consulted after the exact codes missed. Rules are split by protocol,
+ * the commands of a protocol are cut into intervals, and the addresses
+ * of each by the rules covering it, into cells that list the rules
+ * spanning them. A lookup is two binary searches and a check of the ?
+ * digits of the few rules left in its cell. The first rule of the layer
+ * wins, then the first of the global table.
+ */
+typedef struct rule_index rule_index_t;
+
+/* Index of the rules of layer and the global table in mymap, NULL on failure */
+rule_index_t *rule_index_new(map_t mymap, int layer);
+
+map_entry_t *rule_lookup(const rule_index_t *index, uint8_t protocol, uint16_t address, uint16_t command);
+
+void rule_index_free(rule_index_t *index);
+
+#endif
@@ -0,0 +1,453 @@
+/*
+    irmpexec -- LIRC client that reads IRMP events from the USB IR Remote Receiver 
+                and executes a command
+	        http://www.mikrocontroller.net/articles/USB_IR_Remote_Receiver
+    Copyright (C) 2012  Dirk E. Wagner
+
+    This program is free software; you can redistribute it and/or modify it
+    under the terms of version 2 of the GNU General Public License as published
+    by the Free Software Foundation.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program; if not, write to the Free Software
+    Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301 USA
+*/
+
+ /* Standard headers */
+#include <stdio.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <syslog.h>
+
+#include "debug.h"
+#include "hashmap.h"
+#include "sequence.h"
+
+/* Pseudo key fed on the first repetition of a held key */
+#define TOKEN_HOLD               0
+
+typedef struct {
+	char *name;
+	int id;
+} token_t;
+
+typedef struct {
+	int child;		// first child in the trie
+	int sibling;		// next child of our parent
+	int token;		// token leading to this node
+	int fail;		// longest proper suffix that is also a trie node
+	int action;		// action of a sequence ending here, -1 if none
+	int output;		// action to run when entering this state, -1 if none
+	int timeout;		// max. time to wait for the next key in ms
+} node_t;
+
+struct sequence_table {
+	map_t tokens;		// key name -> token_t
+	token_t **token_list;
+	int ntokens;
+	node_t *nodes;
+	int nnodes;
+	char **actions;
+	int nactions;
+	int *delta;		// nnodes x ntokens transition table
+	int state;
+	uint64_t last_ms;
+	int pending;		// output of state held back for a longer sequence, -1 if none
+	int ready;		// output due right away behind the one returned, -1 if none
+};
+
+static void *grow(void *array, int count, size_t size) {
+	/* Double the capacity whenever count reaches a power of two */
+	if (count & (count - 1))
+		return array;
+	return realloc(array, (count ? 2 * count : 1) * size);
+}
+
+static int add_token(sequence_table_t *table, const char *name) {
+	token_t *token;
+
+	if (hashmap_get(table->tokens, (char *) name, (void **) &token) == MAP_OK)
+		return token->id;
+
+	token = malloc(sizeof *token);
+	table->token_list = grow(table->token_list, table->ntokens, sizeof *table->token_list);
+	if (!token || !table->token_list)
+		return -1;
+
+	token->name = strdup(name);
+	token->id = table->ntokens;
+	table->token_list[table->ntokens++] = token;
+
+	if (hashmap_put(table->tokens, token->name, token) != MAP_OK)
+		return -1;
+
+	return token->id;
+}
+
+static int add_node(sequence_table_t *table, int token) {
+	node_t *node;
+
+	table->nodes = grow(table->nodes, table->nnodes, sizeof *table->nodes);
+	if (!table->nodes)
+		return -1;
+
+	node = &table->nodes[table->nnodes];
+	node->child = node->sibling = -1;
+	node->token = token;
+	node->fail = 0;
+	node->action = node->output = -1;
+	node->timeout = 0;
+
+	return table->nnodes++;
+}
+
+static int goto_node(sequence_table_t *table, int node, int token) {
+	int child;
+
+	for (child = table->nodes[node].child; child >= 0; child = table->nodes[child].sibling)
+		if (table->nodes[child].token == token)
+			return child;
+
+	return -1;
+}
+
+sequence_table_t *sequence_table_new(void) {
+	sequence_table_t *table = calloc(1, sizeof *table);
+
+	if (!table)
+		return NULL;
+
+	table->pending = table->ready = -1;
+	table->tokens = hashmap_new();
+	if (!table->tokens || add_token(table, "+") != TOKEN_HOLD || add_node(table, -1) != 0) {
+		sequence_table_free(table);
+		return NULL;
+	}
+
+	return table;
+}
+
+void sequence_table_free(sequence_table_t *table) {
+	int i;
+
+	if (!table)
+		return;
+
+	for (i = 0; i < table->ntokens; i++) {
+		free(table->token_list[i]->name);
+		free(table->token_list[i]);
+	}
+	for (i = 0; i < table->nactions; i++)
+		free(table->actions[i]);
+
+	if (table->tokens)
+		hashmap_free(table->tokens);
+	free(table->token_list);
+	free(table->nodes);
+	free(table->actions);
+	free(table->delta);
+	free(table);
+}
+
+static int add_step(sequence_table_t *table, int node, int token, int timeout) {
+	int next;
+
+	if (token < 0)
+		return -1;
+
+	if ((next = goto_node(table, node, token)) < 0) {
+		if ((next = add_node(table, token)) < 0)
+			return -1;
+		table->nodes[next].sibling = table->nodes[node].child;
+		table->nodes[node].child = next;
+	}
+
+	if (table->nodes[next].timeout < timeout)
+		table->nodes[next].timeout = timeout;
+
+	return next;
+}
+
+bool sequence_add(sequence_table_t *table, const char *keys, const char *action) {
+	char *buf, *key, *save = NULL, *at;
+	int node = 0, timeout = SEQUENCE_TIMEOUT_MS;
+	size_t len;
+
+	buf = strdup(keys);
+	if (!buf)
+		return false;
+
+	if ((at = strrchr(buf, '@'))) {
+		*at = '\0';
+		timeout = atoi(at + 1);
+	}
+
+	for (key = strtok_r(buf, ",", &save); key && node >= 0; key = strtok_r(NULL, ",", &save)) {
+		bool held = false;
+
+		len = strlen(key);
+		if (len > 1 && key[len - 1] == '+') {
+			key[len - 1] = '\0';
+			held = true;
+		}
+
+		node = add_step(table, node, add_token(table, key), timeout);
+
+		/* A held key is the key itself followed by the hold token */
+		if (held && node >= 0)
+			node = add_step(table, node, TOKEN_HOLD, timeout);
+	}
+	free(buf);
+
+	if (node <= 0)
+		return false;
+
+	if (table->nodes[node].action >= 0) {
+		syslog(LOG_ERR, "sequence %s defined twice, using the last definition\n", keys);
+		free(table->actions[table->nodes[node].action]);
+		table->actions[table->nodes[node].action] = strdup(action);
+		return true;
+	}
+
+	table->actions = grow(table->actions, table->nactions, sizeof *table->actions);
+	if (!table->actions)
+		return false;
+	table->actions[table->nactions] = strdup(action);
+	table->nodes[node].action = table->nactions++;
+
+	return true;
+}
+
+/*
+ * Turn the trie into a DFA (Aho-Corasick): every state gets a transition for
+ * every known key, so a mismatch never has to backtrack.
+ */
+bool sequence_compile(sequence_table_t *table) {
+	int *queue, head = 0, tail = 0;
+	int node, child, token, ntokens = table->ntokens;
+
+	free(table->delta);
+	table->delta = malloc((size_t) table->nnodes * ntokens * sizeof *table->delta);
+	queue = malloc(table->nnodes * sizeof *queue);
+	if (!table->delta || !queue) {
+		free(queue);
+		return false;
+	}
+
+	queue[tail++] = 0;
+	while (head < tail) {
+		node_t *n = &table->nodes[node = queue[head++]];
+
+		n->output = n->action >= 0 ? n->action : (node ? table->nodes[n->fail].output : -1);
+
+		for (token = 0; token < ntokens; token++) {
+			child = goto_node(table, node, token);
+			if (child >= 0) {
+				table->nodes[child].fail = node ? table->delta[n->fail * ntokens + token] : 0;
+				queue[tail++] = child;
+			} else if (token == TOKEN_HOLD || !node) {
+				/* Holding a key that no sequence waits for changes nothing */
+				child = token == TOKEN_HOLD ? node : 0;
+			} else {
+				child = table->delta[n->fail * ntokens + token];
+			}
+			table->delta[node * ntokens + token] = child;
+		}
+	}
+
+	free(queue);
+	table->state = 0;
+	table->pending = table->ready = -1;
+
+	DBG ("sequence_compile: %d keys, %d states, %d actions\n", ntokens - 1, table->nnodes, table->nactions);
+
+	return true;
+}
+
+int sequence_token(sequence_table_t *table, const char *key) {
+	token_t *token;
+
+	if (hashmap_get(table->tokens, (char *) key, (void **) &token) != MAP_OK)
+		return SEQUENCE_UNKNOWN;
+
+	return token->id;
+}
+
+/*
+ * Enter the state the key leads to. A state whose sequence is the start of
+ * longer ones holds its output back until the next key leaves it, or until
+ * its timeout. Returns the action due now, -1 if none.
+ */
+static int enter(sequence_table_t *table, int id, uint64_t now_ms) {
+	node_t *node;
+
+	table->state = table->delta[table->state * table->ntokens + id];
+	table->last_ms = now_ms;
+
+	node = &table->nodes[table->state];
+	if (node->output < 0)
+		return -1;
+
+	if (node->child >= 0) {
+		table->pending = node->output;
+		return -1;
+	}
+
+	table->state = 0;
+	return node->output;
+}
+
+const char *sequence_feed_token(sequence_table_t *table, int token, int repeat, bool release, uint64_t now_ms) {
+	int id, action, next;
+
+	if (!table->delta)
+		return NULL;
+
+	if (repeat > 1)
+		return NULL;
+
+	if (repeat == 1) {
+		id = TOKEN_HOLD;
+	} else if (token != SEQUENCE_UNKNOWN) {
+		id = token;
+	} else {
+		/* Unknown releases are noise, any other unknown key breaks a sequence */
+		if (release)
+			return NULL;
+		action = table->pending;
+		table->state = 0;
+		table->pending = -1;
+		return action >= 0 ? table->actions[action] : NULL;
+	}
+
+	if (table->state && now_ms - table->last_ms > (uint64_t) table->nodes[table->state].timeout) {
+		DBG ("sequence timed out\n");
+		table->ready = table->pending;
+		table->state = 0;
+		table->pending = -1;
+	}
+
+	if (table->pending >= 0) {
+		next = table->delta[table->state * table->ntokens + id];
+
+		/* Holding the last key of the held back sequence changes nothing */
+		if (id == TOKEN_HOLD && next == table->state)
+			return NULL;
+
+		/* A key that leaves the state lets its output go and starts over */
+		if (goto_node(table, table->state, id) != next) {
+			table->ready = table->pending;
+			table->state = 0;
+		}
+		table->pending = -1;
+	}
+
+	action = enter(table, id, now_ms);
+
+	/* The held back output went first, this one follows on sequence_expire() */
+	if (table->ready >= 0) {
+		id = table->ready;
+		table->ready = action;
+		action = id;
+	}
+
+	return action >= 0 ? table->actions[action] : NULL;
+}
+
+const char *sequence_expire(sequence_table_t *table, uint64_t now_ms) {
+	int action = table->ready;
+
+	if (action >= 0) {
+		table->ready = -1;
+		return table->actions[action];
+	}
+
+	if (table->pending < 0 || now_ms - table->last_ms <= (uint64_t) table->nodes[table->state].timeout)
+		return NULL;
+
+	action = table->pending;
+	table->state = 0;
+	table->pending = -1;
+	return table->actions[action];
+}
+
+int sequence_wait(sequence_table_t *table, uint64_t now_ms) {
+	uint64_t deadline;
+
+	if (table->ready >= 0)
+		return 0;
+	if (table->pending < 0)
+		return -1;
+
+	deadline = table->last_ms + table->nodes[table->state].timeout + 1;
+	return deadline > now_ms ? deadline - now_ms : 0;
+}
+
+const char *sequence_feed(sequence_table_t *table, const char *key, int repeat, uint64_t now_ms) {
+	size_t len = strlen(key);
+	bool release = len >= 3 && !strcmp(key + len - 3, "_UP");
+
+	return sequence_feed_token(table, sequence_token(table, key), repeat, release, now_ms);
+}
+
+int sequence_count(sequence_table_t *table) {
+	return table->nactions;
+}
+
+bool parse_sequence_table(const char *path, sequence_table_t *table) {
+	FILE *file;
+	char *line = NULL;
+	char *keys = NULL, *action = NULL;
+	size_t line_size = 0;
+	bool ok = true;
+
+	if (!path)
+		return false;
+
+	file = fopen(path, "r");
+	if (!file) {
+		fprintf(stderr, "Could not open translation table %s: %s\n", path, strerror(errno));
+		return false;
+	}
+
+	while (getline(&line, &line_size, file) >= 0) {
+		// Skip empty lines and lines starting with "#"
+		if (strcspn(line, "\n\r#") == 0)
+			continue;
+
+		keys = realloc(keys, line_size);
+		action = realloc(action, line_size);
+		if (!keys || !action) {
+			ok = false;
+			break;
+		}
+
+		if (sscanf(line, "%s %[^\n]", keys, action) != 2) {
+			syslog(LOG_ERR, "line ignored: %s\n", line);
+			continue;
+		}
+
+		DBG ("parse_sequence_table: keys = %s, action = %s\n", keys, action);
+
+		if (!sequence_add(table, keys, action)) {
+			fprintf(stderr, "Invalid key sequence %s\n", keys);
+			ok = false;
+			break;
+		}
+	}
+
+	fclose(file);
+	free(line);
+	free(keys);
+	free(action);
+
+	return ok && sequence_compile(table);
+}
@@ -0,0 +1,70 @@
+/*
+    irmpexec -- LIRC client that reads IRMP events from the USB IR Remote Receiver 
+                and executes a command
+	        http://www.mikrocontroller.net/articles/USB_IR_Remote_Receiver
+    Copyright (C) 2012  Dirk E. Wagner
+
+    This program is free software; you can redistribute it and/or modify it
+    under the terms of version 2 of the GNU General Public License as published
+    by the Free Software Foundation.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program; if not, write to the Free Software
+    Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301 USA
+*/
+
+#ifndef __SEQUENCE_H__
+#define __SEQUENCE_H__
+
+#define SEQUENCE_TIMEOUT_MS      (1000)
+#define SEQUENCE_UNKNOWN         (-1)
+
+/*
+ * Key sequences as found in irmpexec.map:
+ *
+ *   KEY_HOME /usr/local/bin/start-vdr-wohn
+ *   KEY_1,KEY_2,KEY_3,KEY_OK@1500 vdr-switch 123
+ *   KEY_MENU+,KEY_1 some-command
+ *
+ * Keys are separated by ',', a trailing '+' means the key has to be held
+ * until it repeats, '@ms' sets the inter-key timeout. All sequences are
+ * compiled into one DFA, so feeding a key is a single table lookup. An
+ * action runs as soon as its keys are seen, unless they also start a
+ * longer sequence: then it waits for the next key, and runs only if that
+ * key leaves the sequence or the inter-key timeout expires.
+ */
+typedef struct sequence_table sequence_table_t;
+
+sequence_table_t *sequence_table_new(void);
+void sequence_table_free(sequence_table_t *table);
+
+bool sequence_add(sequence_table_t *table, const char *keys, const char *action);
+bool sequence_compile(sequence_table_t *table);
+
+/* Returns the action of a completed sequence, or NULL */
+const char *sequence_feed(sequence_table_t *table, const char *key, int repeat, uint64_t now_ms);
+
+/*
+ * The same split in two, so callers can resolve key names once and feed
+ * the token for every key press. release marks a key name ending in _UP.
+ */
+int sequence_token(sequence_table_t *table, const char *key);
+const char *sequence_feed_token(sequence_table_t *table, int token, int repeat, bool release, uint64_t now_ms);
+
+/*
+ * After every feed, and when sequence_wait() ms have passed: returns the
+ * actions that became due one by one, NULL once there are no more.
+ */
+const char *sequence_expire(sequence_table_t *table, uint64_t now_ms);
+int sequence_wait(sequence_table_t *table, uint64_t now_ms);	// -1 if nothing is held back
+
+int sequence_count(sequence_table_t *table);
+
+bool parse_sequence_table(const char *path, sequence_table_t *table);
+
+#endif
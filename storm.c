@@ -0,0 +1,142 @@
+/*
+    irmplircd -- zeroconf LIRC daemon that reads IRMP events from the USB IR Remote Receiver
+	             http://www.mikrocontroller.net/articles/USB_IR_Remote_Receiver
+    Copyright (C) 2011-2014  Dirk E. Wagner
+
+    This program is free software; you can redistribute it and/or modify it
+    under the terms of version 2 of the GNU General Public License as published
+    by the Free Software Foundation.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program; if not, write to the Free Software
+    Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301 USA
+*/
+
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+
+#include "debug.h"
+#include "log.h"
+#include "storm.h"
+
+typedef struct {
+	uint64_t key;
+	int device;
+	storm_bucket_t bucket;
+	double over_since;	// first drop since the bucket was last full, 0 if none
+	double last;		// last frame, quarantined or not
+	bool quarantined;
+} storm_entry_t;
+
+static storm_entry_t table[STORM_SLOTS];
+static double rate = 0;
+static double burst = 0;
+static double device_rate = 0;
+static double device_burst = 0;
+
+static unsigned long code_drops = 0;
+static unsigned long device_drops = 0;
+static unsigned long quarantine_drops = 0;
+static unsigned long quarantines = 0;
+
+bool storm_init(const char *spec) {
+	int n = sscanf(spec, "%lf,%lf,%lf,%lf", &rate, &burst, &device_rate, &device_burst);
+
+	if(n < 1 || rate <= 0)
+		return false;
+	if(n < 2)
+		burst = rate;
+	if(n < 3)
+		device_rate = STORM_DEVICE_FACTOR * rate;
+	if(n < 4)
+		device_burst = STORM_DEVICE_FACTOR * burst;
+
+	return burst >= 1 && device_rate > 0 && device_burst >= 1;
+}
+
+bool storm_active(void) {
+	return rate > 0;
+}
+
+/* Add what flowed in since the last frame, a fresh bucket starts full */
+static void refill(storm_bucket_t *bucket, double rate, double burst, double now) {
+	if(bucket->time == 0)
+		bucket->tokens = burst;
+	else if(now > bucket->time)
+		bucket->tokens += (now - bucket->time) * rate / 1000;
+	if(bucket->tokens > burst)
+		bucket->tokens = burst;
+	bucket->time = now;
+}
+
+bool storm_drop(storm_bucket_t *device_bucket, uint64_t key, int device, double now) {
+	/* Fibonacci hashing as in dedup.c, the device keeps receivers apart */
+	storm_entry_t *entry = &table[((key ^ (uint64_t) device << 56) * 0x9e3779b97f4a7c15ULL) >> 32 & (STORM_SLOTS - 1)];
+	double silence;
+
+	/* A collision starts over, that only lets frames through */
+	if(entry->key != key || entry->device != device || entry->bucket.time == 0) {
+		entry->key = key;
+		entry->device = device;
+		entry->bucket.time = 0;
+		entry->over_since = 0;
+		entry->quarantined = false;
+	}
+
+	silence = now - entry->last;
+	entry->last = now;
+
+	if(entry->quarantined) {
+		if(silence < STORM_RECOVER_MS) {
+			quarantine_drops++;
+			return true;
+		}
+		LOG(LOG_NOTICE, "Code %012llx from device %d recovered", (unsigned long long) key, device);
+		entry->quarantined = false;
+		entry->bucket.time = 0;
+		entry->over_since = 0;
+	}
+
+	refill(&entry->bucket, rate, burst, now);
+	refill(device_bucket, device_rate, device_burst, now);
+
+	/* Slow enough again to fill the bucket, whatever overflowed was a burst */
+	if(entry->bucket.tokens >= burst)
+		entry->over_since = 0;
+
+	if(entry->bucket.tokens < 1) {
+		if(!entry->over_since)
+			entry->over_since = now;
+		else if(now - entry->over_since >= STORM_QUARANTINE_MS) {
+			LOG(LOG_WARNING, "Code %012llx from device %d quarantined", (unsigned long long) key, device);
+			entry->quarantined = true;
+			quarantines++;
+		}
+		code_drops++;
+		return true;
+	}
+
+	if(device_bucket->tokens < 1) {
+		device_drops++;
+		return true;
+	}
+
+	entry->bucket.tokens--;
+	device_bucket->tokens--;
+	return false;
+}
+
+void storm_report(void) {
+	if(!storm_active())
+		return;
+
+	LOG(LOG_NOTICE, "Storm protection dropped %lu frames over the code rate, %lu over the device rate and %lu quarantined, %lu quarantines",
+	    code_drops, device_drops, quarantine_drops, quarantines);
+}
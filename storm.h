@@ -0,0 +1,54 @@
+/*
+    irmplircd -- zeroconf LIRC daemon that reads IRMP events from the USB IR Remote Receiver
+	             http://www.mikrocontroller.net/articles/USB_IR_Remote_Receiver
+    Copyright (C) 2011-2014  Dirk E. Wagner
+
+    This program is free software; you can redistribute it and/or modify it
+    under the terms of version 2 of the GNU General Public License as published
+    by the Free Software Foundation.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program; if not, write to the Free Software
+    Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301 USA
+*/
+
+
+
+#ifndef __STORM_H__
+#define __STORM_H__
+
+#define STORM_SLOTS              (256)	/* must be a power of two */
+#define STORM_DEVICE_FACTOR      (4)	/* default device rate and burst per code rate and burst */
+#define STORM_QUARANTINE_MS      (3000)	/* over the limit this long quarantines a code */
+#define STORM_RECOVER_MS         (1000)	/* silence that lifts a quarantine */
+
+/*
+ * Token buckets against stuck buttons and IR noise, one per code and
+ * device in a small direct mapped table like dedup.c and one per device
+ * kept by the caller. New and repeat frames take a token from both, the
+ * caller lets releases pass so no key is left pressed. A code that stays over
+ * its limit until STORM_QUARANTINE_MS passes without its bucket filling
+ * up again is quarantined, all its frames are dropped until it has been
+ * silent for STORM_RECOVER_MS. Rates are frames per second.
+ */
+typedef struct {
+	double tokens;
+	double time;
+} storm_bucket_t;
+
+/* "<rate>[,<burst>[,<device rate>[,<device burst>]]]" of -Q */
+bool storm_init(const char *spec);
+bool storm_active(void);
+
+/* key is IRMP_KEY(), device the receiver owning device_bucket */
+bool storm_drop(storm_bucket_t *device_bucket, uint64_t key, int device, double now);
+
+/* Log the drop and quarantine counters */
+void storm_report(void);
+
+#endif
@@ -0,0 +1,122 @@
+/*
+    irmplircd -- zeroconf LIRC daemon that reads IRMP events from the USB IR Remote Receiver
+	             http://www.mikrocontroller.net/articles/USB_IR_Remote_Receiver
+    Copyright (C) 2011-2014  Dirk E. Wagner
+
+    This program is free software; you can redistribute it and/or modify it
+    under the terms of version 2 of the GNU General Public License as published
+    by the Free Software Foundation.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program; if not, write to the Free Software
+    Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301 USA
+*/
+
+ /* Standard headers */
+#include <stdio.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <string.h>
+#include <errno.h>
+#include <syslog.h>
+#include <time.h>
+
+#include "debug.h"
+#include "trace.h"
+
+typedef struct {
+	uint64_t ts_ns;		// CLOCK_MONOTONIC
+	uint32_t event;		// sequence number of the report
+	uint8_t stage;
+	uint8_t device;
+	uint16_t arg;
+} trace_record_t;
+
+bool trace_enabled = false;
+
+static const char *trace_path;
+static trace_record_t ring[TRACE_RING_SIZE];
+static uint32_t head = 0;
+static uint32_t event = 0;
+
+static const char *stage_names[TRACE_STAGES] = {
+	[TRACE_READ] = "read",
+	[TRACE_FILTER] = "filter",
+	[TRACE_LOOKUP] = "lookup",
+	[TRACE_FORMAT] = "format",
+	[TRACE_WRITE] = "write",
+};
+
+void trace_init(const char *path) {
+	trace_path = path;
+	trace_enabled = true;
+}
+
+void trace_record(trace_stage_t stage, int device, int arg) {
+	trace_record_t *rec = &ring[head++ & (TRACE_RING_SIZE - 1)];
+	struct timespec ts;
+
+	if (stage == TRACE_READ)
+		event++;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	rec->ts_ns = (uint64_t) ts.tv_sec * 1000000000 + ts.tv_nsec;
+	rec->event = event;
+	rec->stage = stage;
+	rec->device = device;
+	rec->arg = arg;
+}
+
+/*
+ * Every stage becomes a complete ("X") slice that starts where the previous
+ * stage of the same report ended, so the timeline shows where the time went.
+ */
+bool trace_dump(void) {
+	const trace_record_t *rec, *prev = NULL;
+	uint32_t i, start, count;
+	FILE *out;
+	bool first = true;
+
+	if (!trace_enabled)
+		return false;
+
+	out = fopen(trace_path, "w");
+	if (!out) {
+		syslog(LOG_ERR, "Unable to write trace to %s: %s\n", trace_path, strerror(errno));
+		return false;
+	}
+
+	count = head < TRACE_RING_SIZE ? head : TRACE_RING_SIZE;
+	start = head - count;
+
+	fprintf(out, "{\"displayTimeUnit\":\"ns\",\"traceEvents\":[\n");
+	for (i = start; i != head; i++) {
+		rec = &ring[i & (TRACE_RING_SIZE - 1)];
+
+		if (rec->stage != TRACE_READ && prev && prev->event == rec->event)
+			fprintf(out, "%s{\"name\":\"%s\",\"cat\":\"irmplircd\",\"ph\":\"X\",\"ts\":%.3f,\"dur\":%.3f,\"pid\":1,\"tid\":%u,\"args\":{\"event\":%u,\"arg\":%u}}",
+				first ? "" : ",\n", stage_names[rec->stage], prev->ts_ns / 1000.0, (rec->ts_ns - prev->ts_ns) / 1000.0,
+				rec->device, rec->event, rec->arg);
+		else
+			fprintf(out, "%s{\"name\":\"%s\",\"cat\":\"irmplircd\",\"ph\":\"i\",\"s\":\"t\",\"ts\":%.3f,\"pid\":1,\"tid\":%u,\"args\":{\"event\":%u,\"arg\":%u}}",
+				first ? "" : ",\n", stage_names[rec->stage], rec->ts_ns / 1000.0,
+				rec->device, rec->event, rec->arg);
+
+		first = false;
+		prev = rec;
+	}
+	fprintf(out, "\n]}\n");
+
+	if (fclose(out)) {
+		syslog(LOG_ERR, "Unable to write trace to %s: %s\n", trace_path, strerror(errno));
+		return false;
+	}
+
+	syslog(LOG_INFO, "Trace of %u records written to %s\n", count, trace_path);
+	return true;
+}
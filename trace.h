@@ -0,0 +1,46 @@
+/*
+    irmplircd -- zeroconf LIRC daemon that reads IRMP events from the USB IR Remote Receiver
+	             http://www.mikrocontroller.net/articles/USB_IR_Remote_Receiver
+    Copyright (C) 2011-2014  Dirk E. Wagner
+
+    This program is free software; you can redistribute it and/or modify it
+    under the terms of version 2 of the GNU General Public License as published
+    by the Free Software Foundation.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program; if not, write to the Free Software
+    Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301 USA
+*/
+
+#ifndef __TRACE_H__
+#define __TRACE_H__
+
+#define TRACE_RING_SIZE          (4096)	/* must be a power of two */
+
+typedef enum {
+	TRACE_READ,		// report read from the receiver, arg = report flags
+	TRACE_FILTER,		// repeat filter decision, arg = 1 passed / 0 dropped
+	TRACE_LOOKUP,		// translation table lookup, arg = 1 hit / 0 miss
+	TRACE_FORMAT,		// LIRC message formatted, arg = length
+	TRACE_WRITE,		// write to one client completed, arg = client fd
+	TRACE_STAGES
+} trace_stage_t;
+
+extern bool trace_enabled;
+
+/* Record a stage of the current event. No locks, no allocation. */
+void trace_record(trace_stage_t stage, int device, int arg);
+
+#define TRACE(stage, device, arg) do { if (trace_enabled) trace_record(stage, device, arg); } while (0)
+
+void trace_init(const char *path);
+
+/* Write the ring in Chrome trace event format (loadable by Perfetto) */
+bool trace_dump(void);
+
+#endif
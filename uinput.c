@@ -0,0 +1,175 @@
+/*
+    irmplircd -- zeroconf LIRC daemon that reads IRMP events from the USB IR Remote Receiver
+	             http://www.mikrocontroller.net/articles/USB_IR_Remote_Receiver
+    Copyright (C) 2011-2014  Dirk E. Wagner
+
+    This program is free software; you can redistribute it and/or modify it
+    under the terms of version 2 of the GNU General Public License as published
+    by the Free Software Foundation.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program; if not, write to the Free Software
+    Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301 USA
+*/
+
+ /* Standard headers */
+#include <stdio.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <unistd.h>
+#include <string.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <syslog.h>
+#include <sys/ioctl.h>
+#include <linux/uinput.h>
+
+#include "debug.h"
+#include "hashmap.h"
+#include "mapping.h"
+#include "uinput.h"
+#include "log.h"
+
+static const struct {
+	const char *name;
+	int code;
+} keynames[] = {
+#include "keynames.h"
+};
+
+static const char *uinput_paths[] = { "/dev/uinput", "/dev/input/uinput" };
+
+static int uinputfd = -1;
+static unsigned char enabled[KEY_CNT / 8 + 1];	// key bits set on the device
+
+int keycode_lookup(const char *name) {
+	size_t len = strcspn(name, " \t\r\n");
+	size_t i;
+
+	for(i = 0; i < sizeof keynames / sizeof *keynames; i++)
+		if(!strncmp(keynames[i].name, name, len) && keynames[i].name[len] == '\0')
+			return keynames[i].code;
+
+	return -1;
+}
+
+const char *keycode_name(int code) {
+	size_t i;
+
+	for(i = 0; i < sizeof keynames / sizeof *keynames; i++)
+		if(keynames[i].code == code)
+			return keynames[i].name;
+
+	return NULL;
+}
+
+static int resolve_entry(any_t fd, any_t data) {
+	map_entry_t *map_entry = data;
+	int code;
+
+	map_entry->keycode = code = keycode_lookup(map_entry->value);
+	if(code < 0) {
+		DBG ("uinput: no key code for %s\n", map_entry->value);
+		return MAP_OK;
+	}
+
+	if(enabled[code / 8] & (1 << (code % 8)))
+		return MAP_OK;
+
+	/* Keys can only be enabled before the device is created */
+	if(!fd) {
+		LOG(LOG_WARNING, "uinput: %s is injected after a restart", map_entry->value);
+		return MAP_OK;
+	}
+
+	if(ioctl(*(int *)fd, UI_SET_KEYBIT, code) < 0)
+		return MAP_MISSING;
+
+	enabled[code / 8] |= 1 << (code % 8);
+	return MAP_OK;
+}
+
+int uinput_export(unsigned char *keybits, int size) {
+	if(uinputfd >= 0)
+		memcpy(keybits, enabled, size < sizeof enabled ? size : sizeof enabled);
+	return uinputfd;
+}
+
+void uinput_adopt(int fd, const unsigned char *keybits, int size, map_t mymap) {
+	memset(enabled, 0, sizeof enabled);
+	memcpy(enabled, keybits, size < sizeof enabled ? size : sizeof enabled);
+	uinputfd = fd;
+	uinput_resolve(mymap);
+}
+
+void uinput_resolve(map_t mymap) {
+	if(uinputfd >= 0 && hashmap_length(mymap) > 0)
+		hashmap_iterate(mymap, resolve_entry, NULL);
+}
+
+bool uinput_open(map_t mymap) {
+	struct uinput_setup setup;
+	size_t i;
+	int fd = -1;
+
+	for(i = 0; i < sizeof uinput_paths / sizeof *uinput_paths && fd < 0; i++)
+		fd = open(uinput_paths[i], O_WRONLY | O_NONBLOCK | O_CLOEXEC);
+
+	if(fd < 0) {
+		fprintf(stderr, "Unable to open uinput device: %s\n", strerror(errno));
+		return false;
+	}
+
+	if(ioctl(fd, UI_SET_EVBIT, EV_KEY) < 0 ||
+	   (hashmap_length(mymap) > 0 && hashmap_iterate(mymap, resolve_entry, &fd) != MAP_OK)) {
+		fprintf(stderr, "Unable to set up uinput keys: %s\n", strerror(errno));
+		close(fd);
+		return false;
+	}
+
+	memset(&setup, 0, sizeof setup);
+	setup.id.bustype = BUS_VIRTUAL;
+	snprintf(setup.name, UINPUT_MAX_NAME_SIZE, "irmplircd");
+
+	if(ioctl(fd, UI_DEV_SETUP, &setup) < 0 || ioctl(fd, UI_DEV_CREATE) < 0) {
+		fprintf(stderr, "Unable to create uinput device: %s\n", strerror(errno));
+		close(fd);
+		return false;
+	}
+
+	uinputfd = fd;
+	return true;
+}
+
+void uinput_key(int keycode, int value) {
+	struct input_event events[2];
+
+	if(uinputfd < 0 || keycode < 0)
+		return;
+
+	memset(events, 0, sizeof events);
+	events[0].type = EV_KEY;
+	events[0].code = keycode;
+	events[0].value = value;
+	events[1].type = EV_SYN;
+	events[1].code = SYN_REPORT;
+
+	LOG(LOG_DEBUG, "uinput: code = %d, value = %d", keycode, value);
+
+	if(write(uinputfd, events, sizeof events) != sizeof events)
+		LOG(LOG_ERR, "Error writing to uinput device: %s", strerror(errno));
+}
+
+void uinput_close(void) {
+	if(uinputfd < 0)
+		return;
+
+	ioctl(uinputfd, UI_DEV_DESTROY);
+	close(uinputfd);
+	uinputfd = -1;
+}
@@ -0,0 +1,54 @@
+/*
+    irmplircd -- zeroconf LIRC daemon that reads IRMP events from the USB IR Remote Receiver
+	             http://www.mikrocontroller.net/articles/USB_IR_Remote_Receiver
+    Copyright (C) 2011-2014  Dirk E. Wagner
+
+    This program is free software; you can redistribute it and/or modify it
+    under the terms of version 2 of the GNU General Public License as published
+    by the Free Software Foundation.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program; if not, write to the Free Software
+    Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301 USA
+*/
+
+#ifndef __UINPUT_H__
+#define __UINPUT_H__
+
+#define UINPUT_RELEASE (0)
+#define UINPUT_PRESS (1)
+#define UINPUT_REPEAT (2)
+
+/* Returns the linux/input.h code for a KEY_ or BTN_ name, -1 if unknown */
+int keycode_lookup(const char *name);
+
+/* The first KEY_ or BTN_ name of a code, NULL if it has none */
+const char *keycode_name(int code);
+
+/*
+ * Resolve the key names of all translation table entries and create a
+ * virtual input device that can emit them. Returns false on failure.
+ */
+bool uinput_open(map_t mymap);
+
+/*
+ * The device and the bits of the keys it was created with, for a new
+ * process to take over with uinput_adopt(). Returns -1 without device.
+ */
+int uinput_export(unsigned char *keybits, int size);
+void uinput_adopt(int fd, const unsigned char *keybits, int size, map_t mymap);
+
+/* Resolve the key names of a reloaded translation table */
+void uinput_resolve(map_t mymap);
+
+/* Inject a key event, value is one of UINPUT_RELEASE/PRESS/REPEAT */
+void uinput_key(int keycode, int value);
+
+void uinput_close(void);
+
+#endif
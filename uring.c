@@ -0,0 +1,558 @@
+/*
+    irmplircd -- zeroconf LIRC daemon that reads IRMP events from the USB IR Remote Receiver
+	             http://www.mikrocontroller.net/articles/USB_IR_Remote_Receiver
+    Copyright (C) 2011-2014  Dirk E. Wagner
+
+    This program is free software; you can redistribute it and/or modify it
+    under the terms of version 2 of the GNU General Public License as published
+    by the Free Software Foundation.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program; if not, write to the Free Software
+    Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301 USA
+*/
+
+
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <string.h>
+#include <errno.h>
+#include <syslog.h>
+#include <poll.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/syscall.h>
+#include <linux/io_uring.h>
+
+#include "debug.h"
+#include "uring.h"
+#include "log.h"
+
+/* IORING_OP_READ_MULTISHOT, Linux 6.7, older headers do not know it */
+#define URING_OP_READ_MULTISHOT  (49)
+
+#define URING_BUFFER_GROUP       (0)
+#define URING_NO_CALLBACK        (~0ULL)
+
+#define LOAD(x) __atomic_load_n(&(x), __ATOMIC_ACQUIRE)
+#define STORE(x, v) __atomic_store_n(&(x), (v), __ATOMIC_RELEASE)
+
+struct uring_message {
+	int refs;
+	int len;
+	struct uring_message *next;	// free list link
+	char data[URING_MESSAGE_SIZE];
+};
+
+/* An operation in flight, user_data is its slot and generation */
+typedef struct {
+	uint8_t opcode;
+	bool live;		// false once cancelled, no more callbacks
+	int fd;
+	uint32_t generation;
+	uring_callback_t done;
+	void *arg;
+	unsigned long tag;
+	uring_message_t *message;
+	int next;		// free list link
+} uring_op_t;
+
+static int ringfd = -1;
+
+static unsigned *sq_head, *sq_tail, sq_mask, sq_entries;
+static unsigned *cq_head, *cq_tail, cq_mask;
+static struct io_uring_sqe *sqes;
+static struct io_uring_cqe *cqes;
+static void *ring;
+static size_t ring_size, sqes_size;
+static unsigned sq_local_tail;
+static unsigned expected;	// completions owed by sends and cancels since the last wait
+
+static struct io_uring_buf_ring *buffer_ring;
+static char *buffers;
+static int buffer_size;
+static uint16_t buffer_tail;
+
+static uring_op_t *ops = NULL;
+static int nops = 0;
+static int free_op = -1;
+
+static uring_message_t *free_messages = NULL;
+
+static int io_uring_setup(unsigned entries, struct io_uring_params *p) {
+	return syscall(__NR_io_uring_setup, entries, p);
+}
+
+static int io_uring_enter(unsigned to_submit, unsigned min_complete, unsigned flags, void *arg, size_t argsz) {
+	return syscall(__NR_io_uring_enter, ringfd, to_submit, min_complete, flags, arg, argsz);
+}
+
+static int io_uring_register(unsigned opcode, void *arg, unsigned nargs) {
+	return syscall(__NR_io_uring_register, ringfd, opcode, arg, nargs);
+}
+
+static bool supported(unsigned features) {
+	struct io_uring_probe *probe;
+	bool ok;
+
+	if(!(features & IORING_FEAT_EXT_ARG) || !(features & IORING_FEAT_NODROP))
+		return false;
+
+	probe = calloc(1, sizeof *probe + 256 * sizeof probe->ops[0]);
+	if(!probe)
+		return false;
+
+	ok = io_uring_register(IORING_REGISTER_PROBE, probe, 256) == 0 &&
+	     probe->last_op >= URING_OP_READ_MULTISHOT &&
+	     (probe->ops[URING_OP_READ_MULTISHOT].flags & IO_URING_OP_SUPPORTED) &&
+	     (probe->ops[IORING_OP_POLL_ADD].flags & IO_URING_OP_SUPPORTED) &&
+	     (probe->ops[IORING_OP_SEND].flags & IO_URING_OP_SUPPORTED) &&
+	     (probe->ops[IORING_OP_ASYNC_CANCEL].flags & IO_URING_OP_SUPPORTED);
+
+	free(probe);
+	return ok;
+}
+
+static void give_buffer(int bid) {
+	struct io_uring_buf *buf = &buffer_ring->bufs[buffer_tail & (URING_BUFFERS - 1)];
+
+	buf->addr = (uintptr_t) (buffers + bid * buffer_size);
+	buf->len = buffer_size;
+	buf->bid = bid;
+	buffer_tail++;
+	STORE(buffer_ring->tail, buffer_tail);
+}
+
+static bool map_rings(struct io_uring_params *p) {
+	struct io_uring_buf_reg reg;
+	int i;
+
+	ring_size = p->sq_off.array + p->sq_entries * sizeof(unsigned);
+	if(ring_size < p->cq_off.cqes + p->cq_entries * sizeof(struct io_uring_cqe))
+		ring_size = p->cq_off.cqes + p->cq_entries * sizeof(struct io_uring_cqe);
+	sqes_size = p->sq_entries * sizeof(struct io_uring_sqe);
+
+	/* Both rings are in one mapping, IORING_FEAT_SINGLE_MMAP */
+	ring = mmap(NULL, ring_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ringfd, IORING_OFF_SQ_RING);
+	if(ring == MAP_FAILED) {
+		ring = NULL;
+		return false;
+	}
+
+	sqes = mmap(NULL, sqes_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ringfd, IORING_OFF_SQES);
+	if(sqes == MAP_FAILED) {
+		sqes = NULL;
+		return false;
+	}
+
+	sq_head = (unsigned *) ((char *) ring + p->sq_off.head);
+	sq_tail = (unsigned *) ((char *) ring + p->sq_off.tail);
+	sq_mask = *(unsigned *) ((char *) ring + p->sq_off.ring_mask);
+	sq_entries = p->sq_entries;
+	sq_local_tail = *sq_tail;
+
+	/* Submission slots are used in order, so the index array is fixed */
+	for(i = 0; i < sq_entries; i++)
+		((unsigned *) ((char *) ring + p->sq_off.array))[i] = i;
+
+	cq_head = (unsigned *) ((char *) ring + p->cq_off.head);
+	cq_tail = (unsigned *) ((char *) ring + p->cq_off.tail);
+	cq_mask = *(unsigned *) ((char *) ring + p->cq_off.ring_mask);
+	cqes = (struct io_uring_cqe *) ((char *) ring + p->cq_off.cqes);
+
+	buffer_ring = mmap(NULL, URING_BUFFERS * sizeof(struct io_uring_buf), PROT_READ | PROT_WRITE,
+	                   MAP_ANONYMOUS | MAP_PRIVATE | MAP_POPULATE, -1, 0);
+	if(buffer_ring == MAP_FAILED) {
+		buffer_ring = NULL;
+		return false;
+	}
+
+	buffers = malloc(URING_BUFFERS * buffer_size);
+	if(!buffers)
+		return false;
+
+	memset(&reg, 0, sizeof reg);
+	reg.ring_addr = (uintptr_t) buffer_ring;
+	reg.ring_entries = URING_BUFFERS;
+	reg.bgid = URING_BUFFER_GROUP;
+	if(io_uring_register(IORING_REGISTER_PBUF_RING, &reg, 1) < 0)
+		return false;
+
+	for(i = 0; i < URING_BUFFERS; i++)
+		give_buffer(i);
+
+	return true;
+}
+
+bool uring_open(unsigned entries, int size) {
+	struct io_uring_params p;
+
+	memset(&p, 0, sizeof p);
+	p.flags = IORING_SETUP_CQSIZE | IORING_SETUP_SUBMIT_ALL | IORING_SETUP_COOP_TASKRUN |
+	          IORING_SETUP_SINGLE_ISSUER | IORING_SETUP_DEFER_TASKRUN;
+	p.cq_entries = 4 * entries;
+	buffer_size = size;
+
+	ringfd = io_uring_setup(entries, &p);
+	if(ringfd < 0) {
+		LOG(LOG_WARNING, "io_uring not available: %s", strerror(errno));
+		return false;
+	}
+
+	if(!(p.features & IORING_FEAT_SINGLE_MMAP) || !supported(p.features)) {
+		LOG(LOG_WARNING, "io_uring lacks multishot reads or extended waits");
+		uring_close();
+		return false;
+	}
+
+	if(!map_rings(&p)) {
+		LOG(LOG_WARNING, "Unable to set up io_uring rings: %s", strerror(errno));
+		uring_close();
+		return false;
+	}
+
+	return true;
+}
+
+bool uring_active(void) {
+	return ringfd >= 0;
+}
+
+void uring_close(void) {
+	uring_message_t *message;
+
+	if(sqes)
+		munmap(sqes, sqes_size);
+	if(ring)
+		munmap(ring, ring_size);
+	if(ringfd >= 0)
+		close(ringfd);
+	/* The kernel dropped its reference to the buffer ring with the ring */
+	if(buffer_ring)
+		munmap(buffer_ring, URING_BUFFERS * sizeof(struct io_uring_buf));
+	free(buffers);
+	free(ops);
+
+	while(free_messages) {
+		message = free_messages;
+		free_messages = message->next;
+		free(message);
+	}
+
+	sqes = NULL;
+	ring = NULL;
+	buffer_ring = NULL;
+	buffers = NULL;
+	ops = NULL;
+	nops = 0;
+	free_op = -1;
+	ringfd = -1;
+}
+
+static int pending(void) {
+	return sq_local_tail - LOAD(*sq_head);
+}
+
+static void publish(void) {
+	STORE(*sq_tail, sq_local_tail);
+}
+
+static struct io_uring_sqe *get_sqe(void) {
+	struct io_uring_sqe *sqe;
+
+	/* Full, hand what we have to the kernel without waiting */
+	if(pending() == sq_entries) {
+		publish();
+		if(io_uring_enter(pending(), 0, 0, NULL, 0) < 0 && errno != EINTR && errno != EBUSY)
+			LOG(LOG_ERR, "Error during io_uring_enter(): %s", strerror(errno));
+		if(pending() == sq_entries)
+			return NULL;
+	}
+
+	sqe = &sqes[sq_local_tail & sq_mask];
+	memset(sqe, 0, sizeof *sqe);
+	sq_local_tail++;
+	return sqe;
+}
+
+static int alloc_op(void) {
+	uring_op_t *grown;
+	int i, op;
+
+	if(free_op < 0) {
+		grown = realloc(ops, (nops + URING_ENTRIES) * sizeof *ops);
+		if(!grown)
+			return -1;
+		ops = grown;
+		memset(ops + nops, 0, URING_ENTRIES * sizeof *ops);
+		for(i = nops; i < nops + URING_ENTRIES; i++) {
+			ops[i].generation = 1;
+			ops[i].next = i + 1 < nops + URING_ENTRIES ? i + 1 : -1;
+		}
+		free_op = nops;
+		nops += URING_ENTRIES;
+	}
+
+	op = free_op;
+	free_op = ops[op].next;
+	return op;
+}
+
+static void free_slot(int op) {
+	ops[op].opcode = 0;
+	ops[op].live = false;
+	ops[op].generation++;
+	ops[op].next = free_op;
+	free_op = op;
+}
+
+static uint64_t user_data(int op) {
+	return (uint64_t) ops[op].generation << 32 | op;
+}
+
+/* (Re)arm a multishot operation in its slot */
+static bool arm(int op) {
+	struct io_uring_sqe *sqe = get_sqe();
+
+	if(!sqe)
+		return false;
+
+	sqe->opcode = ops[op].opcode;
+	sqe->fd = ops[op].fd;
+	sqe->user_data = user_data(op);
+
+	if(ops[op].opcode == IORING_OP_POLL_ADD) {
+		sqe->poll32_events = POLLIN;
+		sqe->len = IORING_POLL_ADD_MULTI;
+	} else {
+		sqe->flags = IOSQE_BUFFER_SELECT;
+		sqe->buf_group = URING_BUFFER_GROUP;
+		sqe->off = -1;
+	}
+
+	return true;
+}
+
+static uint64_t start(uint8_t opcode, int fd, uring_callback_t done, void *arg) {
+	int op = alloc_op();
+
+	if(op < 0)
+		return 0;
+
+	ops[op].opcode = opcode;
+	ops[op].live = true;
+	ops[op].fd = fd;
+	ops[op].done = done;
+	ops[op].arg = arg;
+	ops[op].tag = 0;
+	ops[op].message = NULL;
+
+	if(!arm(op)) {
+		free_slot(op);
+		return 0;
+	}
+
+	return user_data(op);
+}
+
+uint64_t uring_read(int fd, uring_callback_t done, void *arg) {
+	return start(URING_OP_READ_MULTISHOT, fd, done, arg);
+}
+
+uint64_t uring_poll(int fd, uring_callback_t done, void *arg) {
+	return start(IORING_OP_POLL_ADD, fd, done, arg);
+}
+
+void uring_cancel(uint64_t handle) {
+	struct io_uring_sqe *sqe;
+	int op = (uint32_t) handle;
+
+	if(!handle || op >= nops || ops[op].generation != handle >> 32 || !ops[op].live)
+		return;
+
+	/* The slot stays taken until the last completion arrived */
+	ops[op].live = false;
+
+	sqe = get_sqe();
+	if(!sqe) {
+		LOG(LOG_ERR, "Unable to cancel io_uring operation on %d", ops[op].fd);
+		return;
+	}
+
+	sqe->opcode = IORING_OP_ASYNC_CANCEL;
+	sqe->addr = handle;
+	sqe->user_data = URING_NO_CALLBACK;
+	expected++;
+}
+
+uring_message_t *uring_message(const void *data, int len) {
+	uring_message_t *message;
+
+	if(len > URING_MESSAGE_SIZE)
+		return NULL;
+
+	if(free_messages) {
+		message = free_messages;
+		free_messages = message->next;
+	} else if(!(message = malloc(sizeof *message)))
+		return NULL;
+
+	message->refs = 1;
+	message->len = len;
+	memcpy(message->data, data, len);
+	return message;
+}
+
+void uring_release(uring_message_t *message) {
+	if(--message->refs > 0)
+		return;
+
+	message->next = free_messages;
+	free_messages = message;
+}
+
+bool uring_send(int fd, uring_message_t *message, uring_callback_t done, void *arg, unsigned long tag) {
+	struct io_uring_sqe *sqe;
+	int op = alloc_op();
+
+	if(op < 0)
+		return false;
+
+	sqe = get_sqe();
+	if(!sqe) {
+		free_slot(op);
+		return false;
+	}
+
+	ops[op].opcode = IORING_OP_SEND;
+	ops[op].live = true;
+	ops[op].fd = fd;
+	ops[op].done = done;
+	ops[op].arg = arg;
+	ops[op].tag = tag;
+	ops[op].message = message;
+	message->refs++;
+
+	/* A full socket fails like write() would instead of waiting for room */
+	sqe->opcode = IORING_OP_SEND;
+	sqe->fd = fd;
+	sqe->addr = (uintptr_t) message->data;
+	sqe->len = message->len;
+	sqe->msg_flags = MSG_DONTWAIT | MSG_NOSIGNAL;
+	sqe->user_data = user_data(op);
+	expected++;
+	return true;
+}
+
+static void complete(const struct io_uring_cqe *cqe) {
+	int op = (uint32_t) cqe->user_data;
+	bool more = cqe->flags & IORING_CQE_F_MORE;
+	const void *data = NULL;
+	int res = cqe->res;
+	int bid;
+
+	if(cqe->user_data == URING_NO_CALLBACK || op >= nops || ops[op].generation != cqe->user_data >> 32)
+		return;
+
+	switch(ops[op].opcode) {
+		case IORING_OP_SEND:
+			if(res >= 0 && res != ops[op].message->len)
+				res = -EIO;
+			uring_release(ops[op].message);
+			if(ops[op].live)
+				ops[op].done(ops[op].arg, ops[op].tag, res, NULL);
+			free_slot(op);
+			return;
+
+		case URING_OP_READ_MULTISHOT:
+			if(cqe->flags & IORING_CQE_F_BUFFER) {
+				bid = cqe->flags >> IORING_CQE_BUFFER_SHIFT;
+				data = buffers + bid * buffer_size;
+				if(ops[op].live && res > 0)
+					ops[op].done(ops[op].arg, 0, res, data);
+				give_buffer(bid);
+			}
+			/* Out of buffers is not an error, we just gave them back */
+			if(!more && (res > 0 || res == -ENOBUFS) && ops[op].live && arm(op))
+				return;
+			break;
+
+		case IORING_OP_POLL_ADD:
+			if(ops[op].live && res >= 0)
+				ops[op].done(ops[op].arg, 0, res, NULL);
+			if(!more && res >= 0 && ops[op].live && arm(op))
+				return;
+			break;
+	}
+
+	if(more)
+		return;
+
+	/* Finished for good, tell the owner unless it cancelled */
+	if(ops[op].live) {
+		ops[op].live = false;
+		ops[op].done(ops[op].arg, 0, res > 0 ? -EIO : res, NULL);
+	}
+	free_slot(op);
+}
+
+/* Run the callbacks of everything completed, returns how many */
+static int reap(void) {
+	struct io_uring_cqe cqe;
+	unsigned head = *cq_head;
+	int n = 0;
+
+	while(head != LOAD(*cq_tail)) {
+		cqe = cqes[head & cq_mask];
+		STORE(*cq_head, ++head);
+		complete(&cqe);
+		n++;
+	}
+
+	return n;
+}
+
+int uring_wait(int timeout) {
+	struct io_uring_getevents_arg arg;
+	struct __kernel_timespec ts;
+	int n = 0;
+
+	memset(&arg, 0, sizeof arg);
+	if(timeout >= 0) {
+		ts.tv_sec = timeout / 1000;
+		ts.tv_nsec = (timeout % 1000) * 1000000L;
+		arg.ts = (uintptr_t) &ts;
+	}
+
+	/*
+	 * Sends complete while they are submitted, they never wait for room.
+	 * Their callbacks run right after, so they see when the messages went
+	 * out and not when the next report arrived.
+	 */
+	publish();
+	if(expected) {
+		if(io_uring_enter(pending(), 0, 0, NULL, 0) < 0 && errno != EINTR && errno != EBUSY && errno != EAGAIN)
+			return -1;
+		expected = 0;
+		n = reap();
+		publish();
+	}
+
+	/* Cancels of the callbacks complete at once too, one more keeps them from ending the wait */
+	if(io_uring_enter(pending(), expected + 1, IORING_ENTER_GETEVENTS | IORING_ENTER_EXT_ARG, &arg, sizeof arg) < 0 &&
+	   errno != ETIME && errno != EINTR && errno != EBUSY && errno != EAGAIN)
+		return -1;
+	expected = 0;
+
+	/* Work queued by the callbacks goes out with the next wait */
+	return n + reap();
+}
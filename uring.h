@@ -0,0 +1,79 @@
+/*
+    irmplircd -- zeroconf LIRC daemon that reads IRMP events from the USB IR Remote Receiver
+	             http://www.mikrocontroller.net/articles/USB_IR_Remote_Receiver
+    Copyright (C) 2011-2014  Dirk E. Wagner
+
+    This program is free software; you can redistribute it and/or modify it
+    under the terms of version 2 of the GNU General Public License as published
+    by the Free Software Foundation.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program; if not, write to the Free Software
+    Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301 USA
+*/
+
+
+#ifndef __URING_H__
+#define __URING_H__
+
+#define URING_ENTRIES            (256)	/* submission queue, must be a power of two */
+#define URING_BUFFERS            (64)	/* provided read buffers, must be a power of two */
+#define URING_MESSAGE_SIZE       (64)
+
+/*
+ * io_uring backend: device reads are multishot reads into a ring of
+ * buffers owned by the kernel, the other descriptors are watched by
+ * multishot polls and socket sends are queued until the next uring_wait(),
+ * which submits them, runs their callbacks and then waits for completions.
+ * Talks to the kernel directly, liburing is not needed.
+ */
+
+/*
+ * Completion callback. res is the number of bytes read or sent, the
+ * poll mask or a negative errno, a short send is reported as -EIO.
+ * data is only set for reads and valid until the callback returns.
+ */
+typedef void (*uring_callback_t)(void *arg, unsigned long tag, int res, const void *data);
+
+typedef struct uring_message uring_message_t;
+
+/*
+ * Returns false if io_uring or one of the operations we need is missing,
+ * e.g. multishot reads before Linux 6.7. Reads are at most buffer_size
+ * bytes each.
+ */
+bool uring_open(unsigned entries, int buffer_size);
+bool uring_active(void);
+void uring_close(void);
+
+/*
+ * Read or poll fd until it fails or is cancelled. Returns a handle for
+ * uring_cancel(), 0 on failure. Callbacks stop as soon as it is cancelled.
+ */
+uint64_t uring_read(int fd, uring_callback_t done, void *arg);
+uint64_t uring_poll(int fd, uring_callback_t done, void *arg);
+void uring_cancel(uint64_t handle);
+
+/*
+ * Reference counted copy of data, so one message can be queued for many
+ * descriptors. Every uring_send() holds a reference until it completed,
+ * the creator drops its own with uring_release(). A send to a socket
+ * without room fails with -EAGAIN like a non-blocking write().
+ */
+uring_message_t *uring_message(const void *data, int len);
+void uring_release(uring_message_t *message);
+bool uring_send(int fd, uring_message_t *message, uring_callback_t done, void *arg, unsigned long tag);
+
+/*
+ * Submit everything queued, wait up to timeout ms (-1 forever) for
+ * completions and run their callbacks. Returns -1 if io_uring_enter()
+ * failed for another reason than a timeout or a signal.
+ */
+int uring_wait(int timeout);
+
+#endif